@@ -0,0 +1,343 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * animation.c: shows a directory of frames as animated background
+ *              (--animation). A thread loads the frames ahead of time into a
+ *              small ring buffer (already scaled for each monitor, if
+ *              needed), and a timer shows them at a fixed frame rate.
+ *              Frames are dropped rather than falling behind, and nothing is
+ *              loaded or drawn while the display is off.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <xcb/xcb.h>
+#include <ev.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "image.h"
+#include "background.h"
+#include "display.h"
+#include "unlock_indicator.h"
+#include "animation.h"
+#include "trace.h"
+
+extern bool debug_mode;
+
+/* A Cairo surface containing the specified image (-i), if any. */
+extern cairo_surface_t *img;
+
+extern scaling_mode_t scaling_mode;
+
+/* Number of frames which are loaded ahead of time. */
+#define RING_SIZE 4
+/* How often to check whether the display was turned off (in seconds). */
+#define DPMS_CHECK_INTERVAL 1.0
+
+struct frame {
+    /* Number of the frame since the animation started, i.e. it does not wrap
+     * around when the animation loops. */
+    uint64_t number;
+    cairo_surface_t *surface;
+    /* With --scaling, the frame scaled for the monitors of the layout at the
+     * time it was loaded. */
+    struct scaled_images *scaled;
+};
+
+/* Configuration, set by animation_init() and read-only afterwards. */
+static char **frame_paths = NULL;
+static int num_frames = 0;
+static char *raw_format = NULL;
+static uint32_t frame_min_size[2];
+static bool use_min_size = false;
+static int frames_per_second;
+
+/* State shared with the loading thread, protected by frames_lock. */
+static pthread_mutex_t frames_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frames_cond = PTHREAD_COND_INITIALIZER;
+static struct frame ring[RING_SIZE];
+static int ring_start = 0;
+static int ring_count = 0;
+/* The frame which should be on screen right now. Older frames are skipped. */
+static uint64_t current_frame = 0;
+static bool paused = false;
+static uint64_t frames_loaded = 0;
+static uint64_t frames_skipped = 0;
+static double load_cpu_ms = 0;
+/* The loading thread exited because none of the frames can be loaded. */
+static bool loading_stopped = false;
+/* The monitors to scale the frames for, a copy of what get_monitors() returns
+ * on the main thread. */
+static Rect *monitors = NULL;
+static int num_monitors = 0;
+
+/* State of the main thread. */
+static ev_timer frame_timer;
+static ev_periodic dpms_timer;
+/* The time at which frame 0 was (or would have been) shown. It is moved
+ * forward by the time the animation was paused. */
+static ev_tstamp start_time;
+static ev_tstamp paused_at;
+static uint64_t frames_shown = 0;
+static uint64_t frames_dropped = 0;
+static double present_cpu_ms = 0;
+
+/*
+ * Returns the CPU time the calling thread used since start, in milliseconds.
+ *
+ */
+static double thread_cpu_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+cairo_surface_t *animation_init(const char *dir, const char *image_raw_format,
+                                const uint32_t min_size[2], int fps) {
+    struct dirent **names;
+    const int count = scandir(dir, &names, skip_hidden_files, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "Could not read animation directory \"%s\"\n", dir);
+        return NULL;
+    }
+
+    if (count > 0 && (frame_paths = calloc(count, sizeof(char *))) != NULL) {
+        for (int i = 0; i < count; i++) {
+            if (asprintf(&frame_paths[num_frames], "%s/%s", dir, names[i]->d_name) != -1) {
+                num_frames++;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+
+    if (num_frames == 0) {
+        fprintf(stderr, "Animation directory \"%s\" contains no frames\n", dir);
+        return NULL;
+    }
+
+    raw_format = (image_raw_format != NULL ? strdup(image_raw_format) : NULL);
+    if (min_size != NULL) {
+        frame_min_size[0] = min_size[0];
+        frame_min_size[1] = min_size[1];
+        use_min_size = true;
+    }
+    frames_per_second = fps;
+    DEBUG("animation: %d frames at %d fps\n", num_frames, fps);
+
+    return load_image(frame_paths[0], raw_format, (use_min_size ? frame_min_size : NULL));
+}
+
+static void free_frame(struct frame *frame) {
+    cairo_surface_destroy(frame->surface);
+    free_scaled_images(frame->scaled);
+}
+
+/*
+ * Copies the current monitors for the loading thread. Must be called on the
+ * main thread, with frames_lock held.
+ *
+ */
+static void update_monitors(void) {
+    const int screens = get_monitors(NULL, 0);
+    if (screens > num_monitors) {
+        Rect *grown = realloc(monitors, screens * sizeof(Rect));
+        if (grown == NULL) {
+            return;
+        }
+        monitors = grown;
+    }
+    num_monitors = get_monitors(monitors, screens);
+}
+
+/*
+ * The loading thread: keeps the ring buffer filled with the frames following
+ * the current one. Frames which cannot be loaded (e.g. other files in the
+ * directory, or the directory was removed) are not tried again. Once no
+ * frame is left, the thread exits and the current frame stays on screen.
+ *
+ */
+static void *load_frames(void *arg) {
+    uint64_t next = 1;
+    Rect *layout = NULL;
+    int layout_size = 0;
+    /* Only used by this thread. */
+    bool *bad = calloc(num_frames, sizeof(bool));
+    int num_bad = 0;
+
+    pthread_mutex_lock(&frames_lock);
+    if (bad == NULL) {
+        /* Pretend that no frame can be loaded. */
+        num_bad = num_frames;
+    }
+    while (num_bad < num_frames) {
+        while (ring_count == RING_SIZE || paused) {
+            pthread_cond_wait(&frames_cond, &frames_lock);
+        }
+        /* Don’t bother loading frames which are already too late. */
+        if (next <= current_frame) {
+            frames_skipped += current_frame + 1 - next;
+            next = current_frame + 1;
+        }
+        while (bad[next % num_frames]) {
+            next++;
+        }
+        if (layout_size < num_monitors) {
+            Rect *grown = realloc(layout, num_monitors * sizeof(Rect));
+            if (grown != NULL) {
+                layout = grown;
+                layout_size = num_monitors;
+            }
+        }
+        const int screens = (num_monitors <= layout_size ? num_monitors : 0);
+        memcpy(layout, monitors, screens * sizeof(Rect));
+        pthread_mutex_unlock(&frames_lock);
+
+        struct timespec cpu_start;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        cairo_surface_t *surface = load_image(frame_paths[next % num_frames], raw_format,
+                                              (use_min_size ? frame_min_size : NULL));
+        /* Scaling a large frame takes longer than the frame is shown, so it
+         * must not happen on the main thread. */
+        struct scaled_images *scaled = NULL;
+        if (surface != NULL && scaling_mode != SCALING_NONE && screens > 0) {
+            scaled = scale_image(surface, layout, screens);
+        }
+        const double cpu_ms = thread_cpu_ms(&cpu_start);
+
+        pthread_mutex_lock(&frames_lock);
+        load_cpu_ms += cpu_ms;
+        frames_loaded++;
+        if (surface != NULL) {
+            ring[(ring_start + ring_count) % RING_SIZE] = (struct frame){next, surface, scaled};
+            ring_count++;
+        } else {
+            bad[next % num_frames] = true;
+            num_bad++;
+        }
+        next++;
+    }
+
+    fprintf(stderr, "No animation frame can be loaded anymore, keeping the current frame\n");
+    loading_stopped = true;
+    pthread_mutex_unlock(&frames_lock);
+    free(bad);
+    free(layout);
+    return NULL;
+}
+
+static void show_next_frame(EV_P_ ev_timer *w, int revents) {
+    trace_instant("animation_timeout");
+    struct timespec cpu_start;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+    /* Which frame to show follows from the time, not from how many frames
+     * we managed to show so far. */
+    const uint64_t target = (ev_now(EV_A) - start_time) * frames_per_second;
+    struct frame frame = {0, NULL, NULL};
+
+    pthread_mutex_lock(&frames_lock);
+    current_frame = target;
+    while (ring_count > 0 && ring[ring_start].number <= target) {
+        if (frame.surface != NULL) {
+            free_frame(&frame);
+            frames_dropped++;
+        }
+        frame = ring[ring_start];
+        ring_start = (ring_start + 1) % RING_SIZE;
+        ring_count--;
+    }
+    update_monitors();
+    const uint64_t skipped = frames_skipped;
+    const uint64_t loaded = frames_loaded;
+    const double load_ms = load_cpu_ms;
+    const bool stopped = (loading_stopped && ring_count == 0);
+    pthread_cond_signal(&frames_cond);
+    pthread_mutex_unlock(&frames_lock);
+
+    /* If the next frame is not loaded yet, the current one stays. */
+    if (frame.surface == NULL) {
+        if (stopped) {
+            ev_timer_stop(EV_A_ &frame_timer);
+            ev_periodic_stop(EV_A_ &dpms_timer);
+        }
+        return;
+    }
+
+    cairo_surface_destroy(img);
+    img = frame.surface;
+    /* If the monitors changed since the frame was scaled, it is scaled again
+     * when drawing. */
+    use_scaled_images(frame.scaled);
+    invalidate_background();
+    redraw_screen();
+
+    frames_shown++;
+    present_cpu_ms += thread_cpu_ms(&cpu_start);
+    if (frames_shown % 100 == 0) {
+        DEBUG("animation: %" PRIu64 " frames shown, %" PRIu64 " dropped, CPU time per frame: "
+              "%.2f ms loading, %.2f ms presenting\n",
+              frames_shown, frames_dropped + skipped,
+              (loaded > 0 ? load_ms / loaded : 0), present_cpu_ms / frames_shown);
+    }
+}
+
+static void check_dpms(EV_P_ ev_periodic *w, int revents) {
+    const bool off = display_powered_off();
+    if (off == paused) {
+        return;
+    }
+
+    DEBUG("animation: display turned %s, %s\n", (off ? "off" : "on"), (off ? "pausing" : "resuming"));
+    if (off) {
+        ev_timer_stop(EV_A_ &frame_timer);
+        paused_at = ev_now(EV_A);
+    } else {
+        start_time += ev_now(EV_A) - paused_at;
+        ev_timer_start(EV_A_ &frame_timer);
+    }
+
+    pthread_mutex_lock(&frames_lock);
+    paused = off;
+    pthread_cond_signal(&frames_cond);
+    pthread_mutex_unlock(&frames_lock);
+}
+
+void animation_start(struct ev_loop *loop) {
+    static bool started = false;
+    if (started || num_frames < 2) {
+        return;
+    }
+    started = true;
+
+    pthread_mutex_lock(&frames_lock);
+    update_monitors();
+    pthread_mutex_unlock(&frames_lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, load_frames, NULL) != 0) {
+        fprintf(stderr, "Could not start the animation thread, showing the first frame only\n");
+        return;
+    }
+    pthread_detach(thread);
+
+    start_time = ev_now(loop);
+    ev_timer_init(&frame_timer, show_next_frame, 1.0 / frames_per_second, 1.0 / frames_per_second);
+    ev_timer_start(loop, &frame_timer);
+    /* Only looks at the state display.c tracks, so this does not wait for
+     * the X server. */
+    ev_periodic_init(&dpms_timer, check_dpms, 0., DPMS_CHECK_INTERVAL, NULL);
+    ev_periodic_start(loop, &dpms_timer);
+}
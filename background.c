@@ -0,0 +1,267 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * background.c: places the image (-i) on each monitor (--scaling). Resampling
+ *               large images is expensive, so the scaled image for each
+ *               monitor is computed once per monitor layout (in parallel) and
+ *               redraws only paint the cached copies.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "randr.h"
+#include "image.h"
+#include "parallel.h"
+#include "background.h"
+#include "unlock_indicator.h"
+
+extern bool debug_mode;
+
+/* The current resolution of the X11 root window. */
+extern uint32_t last_resolution[2];
+
+/* A Cairo surface containing the specified image (-i), if any. */
+extern cairo_surface_t *img;
+
+/* How the image is placed on each monitor. */
+extern scaling_mode_t scaling_mode;
+
+struct scaled_image {
+    Rect monitor;
+    /* Position of the scaled image relative to the root window. It is
+     * clipped to the monitor, so it can be smaller than the monitor. */
+    int x;
+    int y;
+    cairo_surface_t *surface;
+    /* Paints surface at x, y, so that redraws do not need a new pattern. */
+    cairo_pattern_t *pattern;
+    /* Whether surface was drawn (and thereby uploaded) already. */
+    bool uploaded;
+};
+
+struct scaled_images {
+    int num_monitors;
+    struct scaled_image images[];
+};
+
+/* The scaled images for img and the current layout, if computed already. */
+static struct scaled_images *current_images = NULL;
+
+bool parse_scaling_mode(const char *name, scaling_mode_t *mode) {
+    static const struct {
+        const char *name;
+        scaling_mode_t mode;
+    } modes[] = {
+        {"none", SCALING_NONE},
+        {"center", SCALING_CENTER},
+        {"fill", SCALING_FILL},
+        {"fit", SCALING_FIT},
+        {"stretch", SCALING_STRETCH},
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (strcmp(modes[i].name, name) == 0) {
+            *mode = modes[i].mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+void free_scaled_images(struct scaled_images *images) {
+    if (images == NULL) {
+        return;
+    }
+    for (int i = 0; i < images->num_monitors; i++) {
+        if (images->images[i].surface != NULL) {
+            cairo_pattern_destroy(images->images[i].pattern);
+            cairo_surface_destroy(images->images[i].surface);
+        }
+    }
+    free(images);
+}
+
+void use_scaled_images(struct scaled_images *images) {
+    free_scaled_images(current_images);
+    current_images = images;
+}
+
+void invalidate_scaled_images(void) {
+    use_scaled_images(NULL);
+}
+
+int get_monitors(Rect *monitors, int max) {
+    if (xr_screens <= 0) {
+        if (max > 0) {
+            monitors[0] = (Rect){0, 0, last_resolution[0], last_resolution[1]};
+        }
+        return 1;
+    }
+    for (int i = 0; i < xr_screens && i < max; i++) {
+        monitors[i] = xr_resolutions[i];
+    }
+    return xr_screens;
+}
+
+static bool layout_changed(void) {
+    if (current_images == NULL) {
+        return true;
+    }
+    const int screens = get_monitors(NULL, 0);
+    if (screens != current_images->num_monitors) {
+        return true;
+    }
+    Rect monitors[screens];
+    get_monitors(monitors, screens);
+    for (int i = 0; i < screens; i++) {
+        if (memcmp(&monitors[i], &current_images->images[i].monitor, sizeof(Rect)) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct scale_job {
+    cairo_surface_t *image;
+    int width;
+    int height;
+    cairo_format_t format;
+    struct scaled_images *result;
+};
+
+/*
+ * Renders the scaled image for one monitor. Runs on any thread: it only reads
+ * the source image and writes its own entry of the result.
+ *
+ */
+static void scale_for_monitor(size_t i, void *arg) {
+    const struct scale_job *job = arg;
+    struct scaled_image *scaled = &job->result->images[i];
+    const double mon_width = scaled->monitor.width;
+    const double mon_height = scaled->monitor.height;
+
+    double scale_x, scale_y;
+    switch (scaling_mode) {
+        case SCALING_FILL:
+            scale_x = scale_y = fmax(mon_width / job->width, mon_height / job->height);
+            break;
+        case SCALING_FIT:
+            scale_x = scale_y = fmin(mon_width / job->width, mon_height / job->height);
+            break;
+        case SCALING_STRETCH:
+            scale_x = mon_width / job->width;
+            scale_y = mon_height / job->height;
+            break;
+        default:
+            scale_x = scale_y = 1;
+            break;
+    }
+
+    /* The scaled image is centered on the monitor. Only the part which is
+     * visible on the monitor is kept. */
+    const double offset_x = (mon_width - job->width * scale_x) / 2;
+    const double offset_y = (mon_height - job->height * scale_y) / 2;
+    const int x0 = fmax(0, floor(offset_x));
+    const int y0 = fmax(0, floor(offset_y));
+    const int x1 = fmin(mon_width, ceil(offset_x + job->width * scale_x));
+    const int y1 = fmin(mon_height, ceil(offset_y + job->height * scale_y));
+    scaled->x = scaled->monitor.x + x0;
+    scaled->y = scaled->monitor.y + y0;
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+
+    cairo_surface_t *surface = cairo_image_surface_create(job->format, x1 - x0, y1 - y0);
+    cairo_t *ctx = cairo_create(surface);
+    cairo_translate(ctx, offset_x - x0, offset_y - y0);
+    cairo_scale(ctx, scale_x, scale_y);
+    cairo_set_source_surface(ctx, job->image, 0, 0);
+    /* GOOD uses a box filter when downscaling, unlike the default bilinear
+     * filter, which skips pixels. PAD avoids fading out the edges. */
+    cairo_pattern_set_filter(cairo_get_source(ctx), CAIRO_FILTER_GOOD);
+    cairo_pattern_set_extend(cairo_get_source(ctx), CAIRO_EXTEND_PAD);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return;
+    }
+    scaled->surface = surface;
+    scaled->pattern = cairo_pattern_create_for_surface(surface);
+    cairo_matrix_t matrix;
+    cairo_matrix_init_translate(&matrix, -scaled->x, -scaled->y);
+    cairo_pattern_set_matrix(scaled->pattern, &matrix);
+}
+
+struct scaled_images *scale_image(cairo_surface_t *image, const Rect *monitors, int num_monitors) {
+    struct scale_job job = {.image = image};
+    if (!image_size(image, &job.width, &job.height) || job.width <= 0 || job.height <= 0) {
+        return NULL;
+    }
+    job.format = (cairo_surface_get_content(image) == CAIRO_CONTENT_COLOR ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32);
+
+    job.result = calloc(1, sizeof(struct scaled_images) + num_monitors * sizeof(struct scaled_image));
+    if (job.result == NULL) {
+        return NULL;
+    }
+    job.result->num_monitors = num_monitors;
+    for (int i = 0; i < num_monitors; i++) {
+        job.result->images[i].monitor = monitors[i];
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* Only image surfaces can be read from several threads at once. */
+    if (cairo_surface_get_type(image) == CAIRO_SURFACE_TYPE_IMAGE) {
+        parallel_for(num_monitors, scale_for_monitor, &job);
+    } else {
+        for (int i = 0; i < num_monitors; i++) {
+            scale_for_monitor(i, &job);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    DEBUG("scaled %d x %d px image for %d monitor(s) in %.1f ms\n",
+          job.width, job.height, num_monitors,
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return job.result;
+}
+
+void draw_scaled_images(cairo_t *ctx) {
+    if (layout_changed()) {
+        const int screens = get_monitors(NULL, 0);
+        Rect monitors[screens];
+        get_monitors(monitors, screens);
+        use_scaled_images(scale_image(img, monitors, screens));
+    }
+    if (current_images == NULL) {
+        return;
+    }
+    for (int i = 0; i < current_images->num_monitors; i++) {
+        struct scaled_image *scaled = &current_images->images[i];
+        if (scaled->surface == NULL) {
+            continue;
+        }
+        if (!scaled->uploaded) {
+            count_upload(scaled->surface);
+            scaled->uploaded = true;
+        }
+        cairo_set_source(ctx, scaled->pattern);
+        cairo_rectangle(ctx, scaled->x, scaled->y,
+                        cairo_image_surface_get_width(scaled->surface),
+                        cairo_image_surface_get_height(scaled->surface));
+        cairo_fill(ctx);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * benchmark.c: measures how long drawing a frame takes on this display
+ *              (--benchmark), to attach numbers to performance bug reports.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+#include <xcb/xcb.h>
+#include <xcb/xcb_aux.h>
+
+#include "i3lock.h"
+#include "xcb.h"
+#include "unlock_indicator.h"
+#include "randr.h"
+#include "dpi.h"
+#include "benchmark.h"
+
+/*******************************************************************************
+ * Variables defined in i3lock.c.
+ ******************************************************************************/
+
+extern uint32_t last_resolution[2];
+extern char color[7];
+extern unlock_state_t unlock_state;
+extern auth_state_t auth_state;
+
+static const struct {
+    const char *name;
+    unlock_state_t unlock_state;
+    auth_state_t auth_state;
+} states[] = {
+    {"background", STATE_STARTED, STATE_AUTH_IDLE},
+    {"key_pressed", STATE_KEY_PRESSED, STATE_AUTH_IDLE},
+    {"key_active", STATE_KEY_ACTIVE, STATE_AUTH_IDLE},
+    {"backspace_active", STATE_BACKSPACE_ACTIVE, STATE_AUTH_IDLE},
+    {"nothing_to_delete", STATE_NOTHING_TO_DELETE, STATE_AUTH_IDLE},
+    {"verify", STATE_KEY_PRESSED, STATE_AUTH_VERIFY},
+    {"lock", STATE_STARTED, STATE_AUTH_LOCK},
+    {"wrong", STATE_KEY_PRESSED, STATE_AUTH_WRONG},
+    {"lock_failed", STATE_STARTED, STATE_I3LOCK_LOCK_FAILED},
+};
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void run_benchmark(int frames) {
+    double *times = calloc(frames, sizeof(double));
+    if (times == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    printf("i3lock benchmark: %d x %d px, %d monitor(s), %ld DPI, %d frames per state\n",
+           last_resolution[0], last_resolution[1], xr_screens, get_dpi_value(), frames);
+    printf("%-20s %10s %10s %14s\n", "state", "median ms", "p99 ms", "KiB per frame");
+
+    xcb_pixmap_t pixmap = create_bg_pixmap(conn, screen, last_resolution, color);
+    for (size_t s = 0; s < sizeof(states) / sizeof(states[0]); s++) {
+        unlock_state = states[s].unlock_state;
+        auth_state = states[s].auth_state;
+
+        const uint64_t uploaded_before = get_uploaded_bytes();
+        for (int i = 0; i < frames; i++) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            draw_image(pixmap, last_resolution);
+            /* Include the time the X server needs to process the frame. */
+            xcb_aux_sync(conn);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            times[i] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        }
+        const uint64_t uploaded = get_uploaded_bytes() - uploaded_before;
+
+        qsort(times, frames, sizeof(double), compare_doubles);
+        const double median = times[frames / 2];
+        const double p99 = times[(int)ceil(frames * 0.99) - 1];
+        printf("%-20s %10.2f %10.2f %14.1f\n", states[s].name, median, p99, uploaded / 1024.0 / frames);
+    }
+
+    xcb_free_pixmap(conn, pixmap);
+    free(times);
+}
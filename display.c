@@ -0,0 +1,257 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * display.c: tracks whether the screen saver (MIT-SCREEN-SAVER) blanked the
+ *            screen or DPMS turned off the display. While it is off, redraws
+ *            are skipped, and a single redraw catches up once it is on again.
+ *
+ *            The X server sends no events for DPMS, so its state is checked
+ *            when the DPMS timeouts predict the display to turn off, and then
+ *            every second until it is on again.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <xcb/xcb.h>
+#include <xcb/screensaver.h>
+#include <xcb/dpms.h>
+#include <ev.h>
+
+#include "i3lock.h"
+#include "xcb.h"
+#include "unlock_indicator.h"
+#include "display.h"
+#include "trace.h"
+#include "roundtrips.h"
+
+extern bool debug_mode;
+
+/* How often to check whether the display is on again (in seconds). */
+#define DPMS_CHECK_INTERVAL 1.0
+/* Checking right at the DPMS timeout could be too early. */
+#define DPMS_TIMEOUT_SLACK 1.0
+
+static bool has_dpms = false;
+/* Seconds without input after which DPMS turns the display off (standby,
+ * suspend or off, whichever comes first), or 0 if it never does. */
+static double dpms_timeout = 0;
+/* When the last input happened (ev_now()). */
+static ev_tstamp last_input;
+static struct ev_loop *display_loop = NULL;
+static xcb_window_t root_window;
+/* The screen saver blanked the screen. An external screen saver draws its own
+ * window, which i3lock is raised above, so that does not count. */
+static bool saver_active = false;
+static bool dpms_off = false;
+static ev_timer dpms_timer;
+
+/* When the display was turned off, and how many redraws were skipped since. */
+static struct timespec off_since;
+static uint64_t redraws_skipped = 0;
+static uint64_t redraws_skipped_total = 0;
+/* A redraw was skipped and no frame was drawn since, so what is on the screen
+ * is outdated. Unlike redraws_skipped, this survives the display turning on
+ * without a redraw (display_input()). */
+static bool redraw_pending = false;
+
+static bool saver_blanks(uint8_t state, uint8_t kind) {
+    return state == XCB_SCREENSAVER_STATE_ON && kind != XCB_SCREENSAVER_KIND_EXTERNAL;
+}
+
+/*
+ * Returns the number of seconds since the last input, if the screen saver
+ * extension knows it, 0 otherwise.
+ *
+ */
+static double seconds_since_input(xcb_window_t root) {
+    if (!xcb_get_extension_data(conn, &xcb_screensaver_id)->present) {
+        return 0;
+    }
+    xcb_screensaver_query_info_reply_t *info =
+        ROUNDTRIP(xcb_screensaver_query_info_reply(conn, xcb_screensaver_query_info(conn, root), NULL));
+    if (info == NULL) {
+        return 0;
+    }
+    const double seconds = info->ms_since_user_input / 1e3;
+    free(info);
+    return seconds;
+}
+
+/*
+ * Returns the DPMS timeout, see dpms_timeout.
+ *
+ */
+static double query_dpms_timeout(void) {
+    xcb_dpms_info_cookie_t info_cookie = xcb_dpms_info(conn);
+    xcb_dpms_get_timeouts_cookie_t timeouts_cookie = xcb_dpms_get_timeouts(conn);
+    xcb_dpms_info_reply_t *info = ROUNDTRIP(xcb_dpms_info_reply(conn, info_cookie, NULL));
+    xcb_dpms_get_timeouts_reply_t *timeouts = ROUNDTRIP(xcb_dpms_get_timeouts_reply(conn, timeouts_cookie, NULL));
+    const bool enabled = (info != NULL && info->state);
+    free(info);
+    if (timeouts == NULL || !enabled) {
+        free(timeouts);
+        return 0;
+    }
+    uint16_t first = 0;
+    const uint16_t all[] = {timeouts->standby_timeout, timeouts->suspend_timeout, timeouts->off_timeout};
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (all[i] != 0 && (first == 0 || all[i] < first)) {
+            first = all[i];
+        }
+    }
+    free(timeouts);
+    return first;
+}
+
+void display_init(int *event_base, xcb_window_t root) {
+    root_window = root;
+    has_dpms = xcb_get_extension_data(conn, &xcb_dpms_id)->present;
+    if (has_dpms) {
+        dpms_off = display_is_off(conn);
+        dpms_timeout = query_dpms_timeout();
+    }
+
+    const xcb_query_extension_reply_t *extreply = xcb_get_extension_data(conn, &xcb_screensaver_id);
+    if (!extreply->present) {
+        DEBUG("MIT-SCREEN-SAVER is not present, only tracking DPMS.\n");
+        return;
+    }
+
+    xcb_screensaver_select_input(conn, root, XCB_SCREENSAVER_EVENT_NOTIFY_MASK);
+    xcb_screensaver_query_info_reply_t *info =
+        ROUNDTRIP(xcb_screensaver_query_info_reply(conn, xcb_screensaver_query_info(conn, root), NULL));
+    if (info != NULL) {
+        saver_active = saver_blanks(info->state, info->kind);
+        /* ev_now() is not available yet, display_start() converts this. */
+        last_input = -(info->ms_since_user_input / 1e3);
+        free(info);
+    }
+
+    if (event_base != NULL) {
+        *event_base = extreply->first_event;
+    }
+    if (display_powered_off()) {
+        clock_gettime(CLOCK_MONOTONIC, &off_since);
+    }
+}
+
+bool display_powered_off(void) {
+    return saver_active || dpms_off;
+}
+
+/*
+ * Updates the state and, when the display was turned on again, draws the
+ * frame which was skipped last.
+ *
+ */
+static void set_state(bool saver, bool dpms, bool redraw) {
+    const bool was_off = display_powered_off();
+    saver_active = saver;
+    dpms_off = dpms;
+    const bool off = display_powered_off();
+    if (off == was_off) {
+        return;
+    }
+
+    if (off) {
+        DEBUG("display turned off (%s), skipping redraws\n", (saver_active ? "screen saver" : "DPMS"));
+        clock_gettime(CLOCK_MONOTONIC, &off_since);
+        redraws_skipped = 0;
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    DEBUG("display turned on after %.1f s, skipped %" PRIu64 " redraws (%" PRIu64 " in total)\n",
+          (now.tv_sec - off_since.tv_sec) + (now.tv_nsec - off_since.tv_nsec) / 1e9,
+          redraws_skipped, redraws_skipped_total);
+    if (redraw && redraw_pending) {
+        redraw_screen();
+    }
+    redraws_skipped = 0;
+}
+
+void display_handle_screensaver_notify(xcb_screensaver_notify_event_t *event) {
+    set_state(saver_blanks(event->state, event->kind), dpms_off, true);
+}
+
+/*
+ * Schedules the next DPMS check: every second while the display is off,
+ * otherwise once DPMS should have turned it off.
+ *
+ */
+static void schedule_dpms_check(void) {
+    ev_timer_stop(display_loop, &dpms_timer);
+    if (dpms_off) {
+        ev_timer_set(&dpms_timer, DPMS_CHECK_INTERVAL, 0.);
+    } else if (dpms_timeout > 0) {
+        const double after = last_input + dpms_timeout + DPMS_TIMEOUT_SLACK - ev_now(display_loop);
+        ev_timer_set(&dpms_timer, (after > 0 ? after : 0.), 0.);
+    } else {
+        return;
+    }
+    ev_timer_start(display_loop, &dpms_timer);
+}
+
+static void check_dpms(EV_P_ ev_timer *w, int revents) {
+    trace_begin("check_dpms");
+    const bool was_off = dpms_off;
+    set_state(saver_active, display_is_off(conn), true);
+    if (!dpms_off && !was_off) {
+        /* Input we do not see (e.g. the pointer) kept the display on, or the
+         * timeouts changed. */
+        dpms_timeout = query_dpms_timeout();
+        last_input = ev_now(EV_A) - seconds_since_input(root_window);
+        /* Something else keeps the display on, check again after a full
+         * timeout rather than right away. */
+        if (last_input + dpms_timeout <= ev_now(EV_A)) {
+            last_input = ev_now(EV_A);
+        }
+    } else if (!dpms_off) {
+        last_input = ev_now(EV_A);
+    }
+    schedule_dpms_check();
+    trace_end("check_dpms");
+}
+
+void display_start(struct ev_loop *loop) {
+    if (!has_dpms) {
+        return;
+    }
+    display_loop = loop;
+    last_input += ev_now(loop);
+    ev_init(&dpms_timer, check_dpms);
+    schedule_dpms_check();
+}
+
+void display_input(void) {
+    if (display_loop == NULL) {
+        return;
+    }
+    /* Input turns the display on (without an event), and DPMS starts
+     * counting again. */
+    last_input = ev_now(display_loop);
+    set_state(saver_active, false, false);
+    schedule_dpms_check();
+}
+
+bool display_skip_redraw(void) {
+    if (!display_powered_off()) {
+        redraw_pending = false;
+        return false;
+    }
+    redraws_skipped++;
+    redraws_skipped_total++;
+    redraw_pending = true;
+    return true;
+}
+
+bool display_redraw_pending(void) {
+    return redraw_pending;
+}
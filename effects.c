@@ -0,0 +1,446 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * effects.c: blurs or pixelates the background (--blur, --pixelate). Both
+ *            work on all four bytes of each 32-bit pixel, so they are correct
+ *            for RGB24 as well as for (premultiplied) ARGB32 surfaces.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "effects.h"
+#include "parallel.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Three passes of a box blur are close enough to a gaussian blur. */
+#define BLUR_PASSES 3
+/* Each job of the horizontal pass blurs this many rows… */
+#define ROWS_PER_JOB 32
+/* …and each job of the vertical pass this many columns. Wider stripes make
+ * better use of the hardware prefetcher, while the column sums of a job
+ * (8 KiB) still fit into the L1 cache. */
+#define COLUMNS_PER_JOB 512
+/* Radii of at least twice this are blurred at a lower resolution, such that
+ * the radius there is still at least this… */
+#define MIN_DOWNSCALED_RADIUS 3
+/* …but the image is shrunk by at most this factor in each dimension. */
+#define MAX_BLUR_DOWNSCALE 8
+
+struct image_buffer {
+    uint32_t *pixels;
+    int stride; /* in pixels */
+};
+
+struct blur_job {
+    struct image_buffer src;
+    struct image_buffer dest;
+    int width;
+    int height;
+    int radius;
+    /* 1 / (2 * radius + 1), to turn the sum of a window into its average. */
+    float scale;
+};
+
+/*******************************************************************************
+ * Horizontal pass: a sliding window over each row, keeping one sum per byte.
+ ******************************************************************************/
+
+static void blur_row(uint32_t *dest, const uint32_t *src, int width, int radius, float scale) {
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 vscale = _mm_set1_ps(scale);
+#define UNPACK(px) _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(px), zero), zero)
+    __m128i sum = zero;
+    for (int k = -radius; k <= radius; k++) {
+        sum = _mm_add_epi32(sum, UNPACK(src[MIN(MAX(k, 0), width - 1)]));
+    }
+    for (int x = 0; x < width; x++) {
+        __m128i avg = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), vscale));
+        avg = _mm_packs_epi32(avg, avg);
+        dest[x] = _mm_cvtsi128_si32(_mm_packus_epi16(avg, avg));
+        sum = _mm_add_epi32(sum, UNPACK(src[MIN(x + radius + 1, width - 1)]));
+        sum = _mm_sub_epi32(sum, UNPACK(src[MAX(x - radius, 0)]));
+    }
+#undef UNPACK
+#else
+    uint32_t sum[4] = {0, 0, 0, 0};
+    for (int k = -radius; k <= radius; k++) {
+        const uint32_t px = src[MIN(MAX(k, 0), width - 1)];
+        for (int c = 0; c < 4; c++) {
+            sum[c] += (px >> (8 * c)) & 0xFF;
+        }
+    }
+    for (int x = 0; x < width; x++) {
+        const uint32_t add = src[MIN(x + radius + 1, width - 1)];
+        const uint32_t sub = src[MAX(x - radius, 0)];
+        uint32_t avg = 0;
+        for (int c = 0; c < 4; c++) {
+            avg |= (uint32_t)(sum[c] * scale + 0.5f) << (8 * c);
+            sum[c] += ((add >> (8 * c)) & 0xFF) - ((sub >> (8 * c)) & 0xFF);
+        }
+        dest[x] = avg;
+    }
+#endif
+}
+
+static void blur_rows_job(size_t i, void *arg) {
+    const struct blur_job *job = arg;
+    const int last = MIN((int)(i + 1) * ROWS_PER_JOB, job->height);
+    for (int y = i * ROWS_PER_JOB; y < last; y++) {
+        blur_row(job->dest.pixels + (size_t)y * job->dest.stride,
+                 job->src.pixels + (size_t)y * job->src.stride,
+                 job->width, job->radius, job->scale);
+    }
+}
+
+/*******************************************************************************
+ * Vertical pass: the same sliding window, moved down a stripe of columns one
+ * row at a time, so that memory is still accessed sequentially.
+ ******************************************************************************/
+
+#ifdef __SSE2__
+/* Stores the averages of 16 sums as 16 bytes and moves the window down. */
+static inline void blur_column_bytes_sse2(unsigned char *dest, const unsigned char *add,
+                                          const unsigned char *sub, uint32_t *sums, __m128 scale) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s[4];
+    for (int k = 0; k < 4; k++) {
+        s[k] = _mm_loadu_si128((const __m128i *)(sums + 4 * k));
+    }
+
+    const __m128i avg_lo = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s[0]), scale)),
+                                           _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s[1]), scale)));
+    const __m128i avg_hi = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s[2]), scale)),
+                                           _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s[3]), scale)));
+    _mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(avg_lo, avg_hi));
+
+    const __m128i a = _mm_loadu_si128((const __m128i *)add);
+    const __m128i b = _mm_loadu_si128((const __m128i *)sub);
+    const __m128i a16[2] = {_mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero)};
+    const __m128i b16[2] = {_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero)};
+    for (int k = 0; k < 4; k++) {
+        const __m128i a32 = (k % 2 == 0 ? _mm_unpacklo_epi16(a16[k / 2], zero) : _mm_unpackhi_epi16(a16[k / 2], zero));
+        const __m128i b32 = (k % 2 == 0 ? _mm_unpacklo_epi16(b16[k / 2], zero) : _mm_unpackhi_epi16(b16[k / 2], zero));
+        s[k] = _mm_sub_epi32(_mm_add_epi32(s[k], a32), b32);
+        _mm_storeu_si128((__m128i *)(sums + 4 * k), s[k]);
+    }
+}
+#endif
+
+static void blur_columns_job(size_t i, void *arg) {
+    const struct blur_job *job = arg;
+    const int first = i * COLUMNS_PER_JOB;
+    const int bytes = (MIN(first + COLUMNS_PER_JOB, job->width) - first) * 4;
+    const int radius = job->radius;
+    uint32_t sums[COLUMNS_PER_JOB * 4] = {0};
+
+#define ROW(buffer, y) ((unsigned char *)(job->buffer.pixels + (size_t)(y)*job->buffer.stride + first))
+    for (int k = -radius; k <= radius; k++) {
+        const unsigned char *row = ROW(src, MIN(MAX(k, 0), job->height - 1));
+        for (int b = 0; b < bytes; b++) {
+            sums[b] += row[b];
+        }
+    }
+
+    for (int y = 0; y < job->height; y++) {
+        unsigned char *dest = ROW(dest, y);
+        const unsigned char *add = ROW(src, MIN(y + radius + 1, job->height - 1));
+        const unsigned char *sub = ROW(src, MAX(y - radius, 0));
+        int b = 0;
+#ifdef __SSE2__
+        const __m128 scale = _mm_set1_ps(job->scale);
+        for (; b + 16 <= bytes; b += 16) {
+            blur_column_bytes_sse2(dest + b, add + b, sub + b, sums + b, scale);
+        }
+#endif
+        for (; b < bytes; b++) {
+            dest[b] = sums[b] * job->scale + 0.5f;
+            sums[b] += add[b] - sub[b];
+        }
+    }
+#undef ROW
+}
+
+/*
+ * Blurs the width x height pixels of image in place.
+ *
+ */
+static bool blur_buffer(struct image_buffer image, int width, int height, int radius) {
+    uint32_t *tmp = malloc((size_t)width * height * sizeof(uint32_t));
+    if (tmp == NULL) {
+        return false;
+    }
+    struct image_buffer buffer = {tmp, width};
+
+    struct blur_job job = {
+        .width = width,
+        .height = height,
+        .radius = radius,
+        .scale = 1.0f / (2 * radius + 1),
+    };
+    for (int pass = 0; pass < BLUR_PASSES; pass++) {
+        job.src = image;
+        job.dest = buffer;
+        parallel_for((height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, blur_rows_job, &job);
+        job.src = buffer;
+        job.dest = image;
+        parallel_for((width + COLUMNS_PER_JOB - 1) / COLUMNS_PER_JOB, blur_columns_job, &job);
+    }
+
+    free(tmp);
+    return true;
+}
+
+/*******************************************************************************
+ * Large radii: blurring a downscaled copy and scaling it up again looks the
+ * same, but the work shrinks with the square of the factor.
+ ******************************************************************************/
+
+struct resample_job {
+    struct image_buffer large;
+    int width;
+    int height;
+    struct image_buffer small;
+    int small_width;
+    int small_height;
+    int factor;
+    /* For each column of the large image, the column of the small image left
+     * of it and the weight (0 to 256) of the column right of it. */
+    const int *columns;
+    const uint16_t *weights;
+};
+
+/* Maps the center of pixel i of the large image to the small image, in 1/256
+ * pixels. */
+static int small_position(int i, int factor) {
+    return MAX((2 * i + 1) * 128 / factor - 128, 0);
+}
+
+/* Averages each block of factor x factor pixels into one pixel. Two bytes are
+ * summed at once, each in its own 16 bit lane, which is enough for up to 257
+ * pixels per block. */
+static void shrink_rows_job(size_t i, void *arg) {
+    const struct resample_job *job = arg;
+    const int last = MIN((int)(i + 1) * ROWS_PER_JOB, job->small_height);
+    for (int sy = i * ROWS_PER_JOB; sy < last; sy++) {
+        const int y0 = sy * job->factor;
+        const int y1 = MIN(y0 + job->factor, job->height);
+        uint32_t *dest = job->small.pixels + (size_t)sy * job->small.stride;
+        for (int sx = 0; sx < job->small_width; sx++) {
+            const int x0 = sx * job->factor;
+            const int x1 = MIN(x0 + job->factor, job->width);
+            uint32_t rb = 0, ag = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint32_t *row = job->large.pixels + (size_t)y * job->large.stride;
+                for (int x = x0; x < x1; x++) {
+                    rb += row[x] & 0x00FF00FF;
+                    ag += (row[x] >> 8) & 0x00FF00FF;
+                }
+            }
+            const uint32_t count = (x1 - x0) * (y1 - y0);
+            dest[sx] = ((rb & 0xFFFF) + count / 2) / count |
+                       (((ag & 0xFFFF) + count / 2) / count) << 8 |
+                       (((rb >> 16) + count / 2) / count) << 16 |
+                       (((ag >> 16) + count / 2) / count) << 24;
+        }
+    }
+}
+
+/* Interpolates between the pixels a and b, weight (0 to 256) being the share
+ * of b. Two bytes are computed at once, each in its own 16 bit lane. */
+static inline uint32_t lerp(uint32_t a, uint32_t b, uint32_t weight) {
+    const uint32_t rb = (((a & 0x00FF00FF) * (256 - weight) + (b & 0x00FF00FF) * weight) >> 8) & 0x00FF00FF;
+    const uint32_t ag = ((((a >> 8) & 0x00FF00FF) * (256 - weight) + ((b >> 8) & 0x00FF00FF) * weight) >> 8) & 0x00FF00FF;
+    return rb | (ag << 8);
+}
+
+#ifdef __SSE2__
+/* Interpolates two pixels, weights being their shares of the pixels right of
+ * them, repeated for each byte. */
+static inline __m128i lerp_sse2(__m128i left, __m128i right, __m128i weights) {
+    const __m128i sum = _mm_add_epi16(_mm_mullo_epi16(left, _mm_sub_epi16(_mm_set1_epi16(256), weights)),
+                                      _mm_mullo_epi16(right, weights));
+    return _mm_srli_epi16(sum, 8);
+}
+#endif
+
+/* Scales the small image up again (bilinear): each row of the small image
+ * is interpolated vertically first, then each pixel horizontally. */
+static void grow_rows_job(size_t i, void *arg) {
+    const struct resample_job *job = arg;
+    /* One more pixel, so that the last pixel has a (weightless) neighbor. */
+    uint32_t *between = malloc((job->small_width + 1) * sizeof(uint32_t));
+    if (between == NULL) {
+        return;
+    }
+    const int last = MIN((int)(i + 1) * ROWS_PER_JOB, job->height);
+    for (int y = i * ROWS_PER_JOB; y < last; y++) {
+        const int position = small_position(y, job->factor);
+        const int sy = MIN(position / 256, job->small_height - 1);
+        const uint32_t *top = job->small.pixels + (size_t)sy * job->small.stride;
+        if (sy == job->small_height - 1) {
+            memcpy(between, top, job->small_width * sizeof(uint32_t));
+        } else {
+            const uint32_t *bottom = top + job->small.stride;
+            for (int sx = 0; sx < job->small_width; sx++) {
+                between[sx] = lerp(top[sx], bottom[sx], position % 256);
+            }
+        }
+        between[job->small_width] = between[job->small_width - 1];
+
+        uint32_t *dest = job->large.pixels + (size_t)y * job->large.stride;
+        const int *columns = job->columns;
+        const uint16_t *weights = job->weights;
+        int x = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 4 <= job->width; x += 4) {
+            const __m128i left = _mm_setr_epi32(between[columns[x]], between[columns[x + 1]],
+                                                between[columns[x + 2]], between[columns[x + 3]]);
+            const __m128i right = _mm_setr_epi32(between[columns[x] + 1], between[columns[x + 1] + 1],
+                                                 between[columns[x + 2] + 1], between[columns[x + 3] + 1]);
+            const __m128i lo = lerp_sse2(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(right, zero),
+                                         _mm_setr_epi16(weights[x], weights[x], weights[x], weights[x],
+                                                        weights[x + 1], weights[x + 1], weights[x + 1], weights[x + 1]));
+            const __m128i hi = lerp_sse2(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(right, zero),
+                                         _mm_setr_epi16(weights[x + 2], weights[x + 2], weights[x + 2], weights[x + 2],
+                                                        weights[x + 3], weights[x + 3], weights[x + 3], weights[x + 3]));
+            _mm_storeu_si128((__m128i *)(dest + x), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; x < job->width; x++) {
+            dest[x] = lerp(between[columns[x]], between[columns[x] + 1], weights[x]);
+        }
+    }
+    free(between);
+}
+
+static bool blur_downscaled(struct image_buffer image, int width, int height, int radius, int factor) {
+    struct resample_job job = {
+        .large = image,
+        .width = width,
+        .height = height,
+        .small_width = (width + factor - 1) / factor,
+        .small_height = (height + factor - 1) / factor,
+        .factor = factor,
+    };
+    job.small.stride = job.small_width;
+    job.small.pixels = malloc((size_t)job.small_width * job.small_height * sizeof(uint32_t));
+    int *columns = malloc(width * sizeof(int));
+    uint16_t *weights = malloc(width * sizeof(uint16_t));
+    if (job.small.pixels == NULL || columns == NULL || weights == NULL) {
+        free(job.small.pixels);
+        free(columns);
+        free(weights);
+        return false;
+    }
+    for (int x = 0; x < width; x++) {
+        const int position = small_position(x, factor);
+        columns[x] = MIN(position / 256, job.small_width - 1);
+        weights[x] = (columns[x] == job.small_width - 1 ? 0 : position % 256);
+    }
+    job.columns = columns;
+    job.weights = weights;
+
+    parallel_for((job.small_height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, shrink_rows_job, &job);
+    const bool blurred = blur_buffer(job.small, job.small_width, job.small_height,
+                                     (radius + factor / 2) / factor);
+    if (blurred) {
+        parallel_for((height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, grow_rows_job, &job);
+    }
+
+    free(job.small.pixels);
+    free(columns);
+    free(weights);
+    return blurred;
+}
+
+void blur_image(cairo_surface_t *img, int radius) {
+    const int width = cairo_image_surface_get_width(img);
+    const int height = cairo_image_surface_get_height(img);
+    if (radius <= 0 || width <= 0 || height <= 0) {
+        return;
+    }
+
+    cairo_surface_flush(img);
+    struct image_buffer image = {
+        (uint32_t *)cairo_image_surface_get_data(img),
+        cairo_image_surface_get_stride(img) / 4,
+    };
+    const int factor = MIN(radius / MIN_DOWNSCALED_RADIUS, MAX_BLUR_DOWNSCALE);
+    const bool blurred = (factor > 1 ? blur_downscaled(image, width, height, radius, factor)
+                                     : blur_buffer(image, width, height, radius));
+    if (!blurred) {
+        fprintf(stderr, "Could not allocate memory to blur the image\n");
+    }
+    cairo_surface_mark_dirty(img);
+}
+
+/*******************************************************************************
+ * Pixelation.
+ ******************************************************************************/
+
+struct pixelate_job {
+    struct image_buffer image;
+    int width;
+    int height;
+    int size;
+};
+
+static void pixelate_row_job(size_t i, void *arg) {
+    const struct pixelate_job *job = arg;
+    const int y0 = i * job->size;
+    const int y1 = MIN(y0 + job->size, job->height);
+    for (int x0 = 0; x0 < job->width; x0 += job->size) {
+        const int x1 = MIN(x0 + job->size, job->width);
+        uint64_t sum[4] = {0, 0, 0, 0};
+        for (int y = y0; y < y1; y++) {
+            const uint32_t *row = job->image.pixels + (size_t)y * job->image.stride;
+            for (int x = x0; x < x1; x++) {
+                for (int c = 0; c < 4; c++) {
+                    sum[c] += (row[x] >> (8 * c)) & 0xFF;
+                }
+            }
+        }
+
+        const uint64_t count = (uint64_t)(x1 - x0) * (y1 - y0);
+        uint32_t avg = 0;
+        for (int c = 0; c < 4; c++) {
+            avg |= (uint32_t)((sum[c] + count / 2) / count) << (8 * c);
+        }
+        for (int y = y0; y < y1; y++) {
+            uint32_t *row = job->image.pixels + (size_t)y * job->image.stride;
+            for (int x = x0; x < x1; x++) {
+                row[x] = avg;
+            }
+        }
+    }
+}
+
+void pixelate_image(cairo_surface_t *img, int size) {
+    struct pixelate_job job = {
+        .width = cairo_image_surface_get_width(img),
+        .height = cairo_image_surface_get_height(img),
+        .size = size,
+    };
+    if (size <= 1 || job.width <= 0 || job.height <= 0) {
+        return;
+    }
+
+    cairo_surface_flush(img);
+    job.image.pixels = (uint32_t *)cairo_image_surface_get_data(img);
+    job.image.stride = cairo_image_surface_get_stride(img) / 4;
+    parallel_for((job.height + size - 1) / size, pixelate_row_job, &job);
+    cairo_surface_mark_dirty(img);
+}
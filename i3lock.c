@@ -16,10 +16,16 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <xcb/xcb.h>
 #include <xcb/xkb.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <assert.h>
 #ifdef __OpenBSD__
 #include <bsd_auth.h>
@@ -46,16 +52,33 @@
 #include "unlock_indicator.h"
 #include "randr.h"
 #include "dpi.h"
+#include "image.h"
+#include "background.h"
+#include "effects.h"
+#include "animation.h"
+#include "slideshow.h"
+#include "display.h"
+#include "probes.h"
+#include "trace.h"
+#include "metrics.h"
+#include "roundtrips.h"
+#include "watchdog.h"
+#include "benchmark.h"
 
 #define TSTAMP_N_SECS(n) (n * 1.0)
 #define TSTAMP_N_MINS(n) (60 * TSTAMP_N_SECS(n))
+/* The password typed so far is discarded after this long without input. */
+#define DISCARD_PASSWD_TIMEOUT TSTAMP_N_MINS(3)
+/* Stack size of the thread raising the i3lock window, see raise_loop(). */
+#define RAISE_THREAD_STACK_SIZE (256 * 1024)
 #define START_TIMER(timer_obj, timeout, callback) \
-    timer_obj = start_timer(timer_obj, timeout, callback)
+    start_timer(&(timer_obj), timeout, callback)
 #define STOP_TIMER(timer_obj) \
-    timer_obj = stop_timer(timer_obj)
+    ev_timer_stop(main_loop, &(timer_obj))
 
 typedef void (*ev_callback_t)(EV_P_ ev_timer *w, int revents);
 static void input_done(void);
+static void start_raise_thread(void);
 
 char color[7] = "a3a3a3";
 uint32_t last_resolution[2];
@@ -71,12 +94,25 @@ static char password[512];
 static bool beep = false;
 bool debug_mode = false;
 bool unlock_indicator = true;
-char *modifier_string = NULL;
 static bool dont_fork = false;
 struct ev_loop *main_loop;
-static struct ev_timer *clear_auth_wrong_timeout;
-static struct ev_timer *clear_indicator_timeout;
-static struct ev_timer *discard_passwd_timeout;
+/* The timers are restarted on every key press, so they are allocated once
+ * instead of for every key press. */
+static struct ev_timer clear_auth_wrong_timeout;
+static struct ev_timer clear_indicator_timeout;
+static struct ev_timer discard_passwd_timeout;
+static struct ev_timer redraw_timeout_timer;
+/* Logs the number of wakeups every minute with --debug. */
+static struct ev_timer wakeup_report_timer;
+/* Reads the image(s) again on SIGHUP. */
+static struct ev_signal sighup_watcher;
+/* Timeouts may be handled up to this much later, so that timeouts which are
+ * close to each other are handled in a single wakeup (--timer-slack). */
+static ev_tstamp timer_slack = 0.1;
+/* When a key was pressed last. The discard_passwd_timeout is only moved when
+ * it expires, not on every key press. */
+static ev_tstamp last_key_press = 0;
+static unsigned int key_presses = 0;
 extern unlock_state_t unlock_state;
 extern auth_state_t auth_state;
 int failed_attempts = 0;
@@ -92,11 +128,50 @@ static struct xkb_compose_state *xkb_compose_state;
 static uint8_t xkb_base_event;
 static uint8_t xkb_base_error;
 static int randr_base = -1;
+static int screensaver_base = -1;
 
 cairo_surface_t *img = NULL;
+/* Where the image was loaded from, so that it can be loaded again. */
+static char *image_path = NULL;
+static char *image_raw_format = NULL;
+static int image_fd = -1;
+/* Use a blurred (--blur) and/or pixelated (--pixelate) screenshot as image. */
+static int blur_radius = 0;
+static int pixelate_size = 0;
+/* Directory with the frames of an animated background (--animation). */
+static char *animation_dir = NULL;
+static int animation_fps = 10;
+/* How often the image changes when several images are given (in seconds). */
+static double slideshow_interval = TSTAMP_N_MINS(5);
+/* The size of the image as loaded, before fit_image_to_resolution(). */
+static int img_full_size[2];
 bool tile = false;
+/* Free the image once it is drawn onto a pixmap on the X server, and load it
+ * again only when the layout changes (--low-memory). */
+bool low_memory = false;
+scaling_mode_t scaling_mode = SCALING_NONE;
 bool ignore_empty_password = false;
 bool skip_repeated_empty_password = false;
+/* When main() was entered, and how long it took from there until the image
+ * was loaded, the first frame was drawn and the keyboard and pointer were
+ * grabbed (logged with --debug and --startup-json). */
+static struct timespec startup_time;
+static double image_loaded_ms = 0;
+static double first_frame_ms = 0;
+static double grabbed_ms = 0;
+/* Where to write the startup milestones as JSON (--startup-json), either a
+ * path or a file descriptor. */
+static const char *startup_json_path = NULL;
+static int startup_json_fd = -1;
+/* Event loop iterations taking longer than this are logged with --debug
+ * (--stall-threshold, in seconds, 0 disables it). */
+static double stall_threshold = 0.1;
+/* How many frames per state to draw with --benchmark, 0 to lock the screen. */
+static int benchmark_frames = 0;
+/* Where to write the timeline of the session (--trace-file), if anywhere. */
+static const char *trace_path = NULL;
+/* When the password was accepted, to measure how long unlocking takes. */
+static struct timespec unlocked_at;
 
 /* isutf, u8_dec © 2005 Jeff Bezanson, public domain */
 #define isutf(c) (((c)&0xC0) != 0x80)
@@ -118,7 +193,7 @@ static void u8_dec(char *s, int *i) {
  * so it must not leave unusable global state behind
  *
  */
-static bool load_keymap(void) {
+static bool _load_keymap(void) {
     if (xkb_context == NULL) {
         if ((xkb_context = xkb_context_new(0)) == NULL) {
             fprintf(stderr, "[i3lock] could not create xkbcommon context\n");
@@ -149,6 +224,16 @@ static bool load_keymap(void) {
     return true;
 }
 
+static bool load_keymap(void) {
+    PROBE(load_keymap_begin);
+    metrics_count(METRIC_KEYMAP_LOADS);
+    trace_begin("load_keymap");
+    const bool ok = _load_keymap();
+    trace_end("load_keymap");
+    PROBE1(load_keymap_end, ok);
+    return ok;
+}
+
 /*
  * Loads the XKB compose table from the given locale.
  *
@@ -197,29 +282,10 @@ static void clear_password_memory(void) {
 #endif
 }
 
-ev_timer *start_timer(ev_timer *timer_obj, ev_tstamp timeout, ev_callback_t callback) {
-    if (timer_obj) {
-        ev_timer_stop(main_loop, timer_obj);
-        ev_timer_set(timer_obj, timeout, 0.);
-        ev_timer_start(main_loop, timer_obj);
-    } else {
-        /* When there is no memory, we just don’t have a timeout. We cannot
-         * exit() here, since that would effectively unlock the screen. */
-        timer_obj = calloc(1, sizeof(struct ev_timer));
-        if (timer_obj) {
-            ev_timer_init(timer_obj, callback, timeout, 0.);
-            ev_timer_start(main_loop, timer_obj);
-        }
-    }
-    return timer_obj;
-}
-
-ev_timer *stop_timer(ev_timer *timer_obj) {
-    if (timer_obj) {
-        ev_timer_stop(main_loop, timer_obj);
-        free(timer_obj);
-    }
-    return NULL;
+static void start_timer(ev_timer *timer_obj, ev_tstamp timeout, ev_callback_t callback) {
+    ev_timer_stop(main_loop, timer_obj);
+    ev_timer_init(timer_obj, callback, timeout, 0.);
+    ev_timer_start(main_loop, timer_obj);
 }
 
 /*
@@ -230,7 +296,11 @@ static void finish_input(void) {
     password[input_position] = '\0';
     unlock_state = STATE_KEY_PRESSED;
     redraw_screen();
+    const roundtrip_phase_t previous = roundtrip_phase_enter(ROUNDTRIP_AUTH);
+    watchdog_enter("input_done");
     input_done();
+    watchdog_leave();
+    roundtrip_phase_leave(previous);
 }
 
 /*
@@ -239,19 +309,11 @@ static void finish_input(void) {
  *
  */
 static void clear_auth_wrong(EV_P_ ev_timer *w, int revents) {
+    trace_instant("clear_auth_wrong_timeout");
     DEBUG("clearing auth wrong\n");
     auth_state = STATE_AUTH_IDLE;
     redraw_screen();
 
-    /* Clear modifier string. */
-    if (modifier_string != NULL) {
-        free(modifier_string);
-        modifier_string = NULL;
-    }
-
-    /* Now free this timeout. */
-    STOP_TIMER(clear_auth_wrong_timeout);
-
     /* retry with input done during auth verification */
     if (retry_verification) {
         retry_verification = false;
@@ -260,8 +322,8 @@ static void clear_auth_wrong(EV_P_ ev_timer *w, int revents) {
 }
 
 static void clear_indicator_cb(EV_P_ ev_timer *w, int revents) {
+    trace_instant("clear_indicator_timeout");
     clear_indicator();
-    STOP_TIMER(clear_indicator_timeout);
 }
 
 static void clear_input(void) {
@@ -271,8 +333,13 @@ static void clear_input(void) {
 }
 
 static void discard_passwd_cb(EV_P_ ev_timer *w, int revents) {
+    trace_instant("discard_passwd_timeout");
+    const ev_tstamp remaining = last_key_press + DISCARD_PASSWD_TIMEOUT - ev_now(EV_A);
+    if (remaining > 0) {
+        START_TIMER(discard_passwd_timeout, remaining, discard_passwd_cb);
+        return;
+    }
     clear_input();
-    STOP_TIMER(discard_passwd_timeout);
 }
 
 static void input_done(void) {
@@ -281,6 +348,9 @@ static void input_done(void) {
     unlock_state = STATE_STARTED;
     redraw_screen();
 
+    PROBE(auth_begin);
+    struct timespec auth_start;
+    clock_gettime(CLOCK_MONOTONIC, &auth_start);
 #ifdef __OpenBSD__
     struct passwd *pw;
 
@@ -288,7 +358,13 @@ static void input_done(void) {
         errx(1, "unknown uid %u.", getuid());
     }
 
-    if (auth_userokay(pw->pw_name, NULL, NULL, password) != 0) {
+    trace_begin("auth_userokay");
+    const bool authenticated = (auth_userokay(pw->pw_name, NULL, NULL, password) != 0);
+    trace_end("auth_userokay");
+    metrics_observe_since(METRIC_AUTH_SECONDS, &auth_start);
+    if (authenticated) {
+        clock_gettime(CLOCK_MONOTONIC, &unlocked_at);
+        PROBE1(auth_end, true);
         DEBUG("successfully authenticated\n");
         clear_password_memory();
 
@@ -296,7 +372,13 @@ static void input_done(void) {
         return;
     }
 #else
-    if (pam_authenticate(pam_handle, 0) == PAM_SUCCESS) {
+    trace_begin("pam_authenticate");
+    const bool authenticated = (pam_authenticate(pam_handle, 0) == PAM_SUCCESS);
+    trace_end("pam_authenticate");
+    metrics_observe_since(METRIC_AUTH_SECONDS, &auth_start);
+    if (authenticated) {
+        clock_gettime(CLOCK_MONOTONIC, &unlocked_at);
+        PROBE1(auth_end, true);
         DEBUG("successfully authenticated\n");
         clear_password_memory();
 
@@ -304,17 +386,21 @@ static void input_done(void) {
          * Related to credentials pam_end() needs to be called to cleanup any temporary
          * credentials like kerberos /tmp/krb5cc_pam_* files which may of been left behind if the
          * refresh of the credentials failed. */
+        trace_begin("pam_setcred");
         pam_setcred(pam_handle, PAM_REFRESH_CRED);
+        trace_end("pam_setcred");
         pam_cleanup = true;
 
         ev_break(EV_DEFAULT, EVBREAK_ALL);
         return;
     }
 #endif
+    PROBE1(auth_end, false);
 
     if (debug_mode) {
         fprintf(stderr, "Authentication failure\n");
     }
+    metrics_count(METRIC_FAILED_ATTEMPTS);
 
     auth_state = STATE_AUTH_WRONG;
     /* The unlock indicator displays the number of failed attempts,
@@ -344,8 +430,34 @@ static void input_done(void) {
 }
 
 static void redraw_timeout(EV_P_ ev_timer *w, int revents) {
+    trace_instant("redraw_timeout");
     redraw_screen();
-    STOP_TIMER(w);
+}
+
+/*
+ * Logs how often the event loop woke up during the last minute, and on
+ * average in minutes with and without typing (--debug only).
+ *
+ */
+static void report_wakeups(EV_P_ ev_timer *w, int revents) {
+    static unsigned int last_iteration = 0;
+    static unsigned int last_key_presses = 0;
+    static unsigned int minutes[2] = {0, 0};
+    static unsigned int wakeups[2] = {0, 0};
+
+    /* Every loop iteration blocks (and wakes up) at most once. */
+    const unsigned int iteration = ev_iteration(EV_A);
+    const unsigned int recent = iteration - last_iteration;
+    const int typing = (key_presses != last_key_presses);
+    last_iteration = iteration;
+    last_key_presses = key_presses;
+    minutes[typing]++;
+    wakeups[typing] += recent;
+
+    DEBUG("%u wakeups in the last minute (%s), %.1f per minute idle, %.1f per minute typing\n",
+          recent, (typing ? "typing" : "idle"),
+          (minutes[0] > 0 ? (double)wakeups[0] / minutes[0] : 0),
+          (minutes[1] > 0 ? (double)wakeups[1] / minutes[1] : 0));
 }
 
 static bool skip_without_validation(void) {
@@ -373,6 +485,7 @@ static void handle_key_press(xcb_key_press_event_t *event) {
     bool ctrl;
     bool composed = false;
 
+    key_presses++;
     ksym = xkb_state_key_get_one_sym(xkb_state, event->detail);
     ctrl = xkb_state_mod_name_is_active(xkb_state, XKB_MOD_NAME_CTRL, XKB_STATE_MODS_DEPRESSED);
 
@@ -512,12 +625,16 @@ static void handle_key_press(xcb_key_press_event_t *event) {
         redraw_screen();
         unlock_state = STATE_KEY_PRESSED;
 
-        struct ev_timer *timeout = NULL;
-        START_TIMER(timeout, TSTAMP_N_SECS(0.25), redraw_timeout);
+        /* Typing restarts the timer, so the highlight is removed 0.25 s
+         * after the last key press. */
+        START_TIMER(redraw_timeout_timer, TSTAMP_N_SECS(0.25), redraw_timeout);
         STOP_TIMER(clear_indicator_timeout);
     }
 
-    START_TIMER(discard_passwd_timeout, TSTAMP_N_MINS(3), discard_passwd_cb);
+    last_key_press = ev_now(main_loop);
+    if (!ev_is_active(&discard_passwd_timeout)) {
+        START_TIMER(discard_passwd_timeout, DISCARD_PASSWD_TIMEOUT, discard_passwd_cb);
+    }
 }
 
 /*
@@ -594,220 +711,284 @@ static void process_xkb_event(xcb_generic_event_t *gevent) {
 }
 
 /*
- * Called when the properties on the root window change, e.g. when the screen
- * resolution changes. If so we update the window to cover the whole screen
- * and also redraw the image, if any.
+ * Returns the number of milliseconds since start (CLOCK_MONOTONIC).
  *
  */
-static void handle_screen_resize(void) {
-    xcb_get_geometry_cookie_t geomc;
-    xcb_get_geometry_reply_t *geom;
-    geomc = xcb_get_geometry(conn, screen->root);
-    if ((geom = xcb_get_geometry_reply(conn, geomc, 0)) == NULL) {
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Blurs and/or pixelates the screenshot in img.
+ *
+ */
+static void apply_effects(void) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (blur_radius > 0) {
+        blur_image(img, blur_radius);
+    }
+    if (pixelate_size > 0) {
+        pixelate_image(img, pixelate_size);
+    }
+    DEBUG("applied effects to %d x %d px screenshot in %.1f ms\n",
+          cairo_image_surface_get_width(img), cairo_image_surface_get_height(img),
+          elapsed_ms(&start));
+}
+
+/*
+ * Drops the parts of the image which are outside of the root window. The image
+ * is painted starting at (0, 0), so only its top-left corner (of the size of
+ * the root window) is ever visible, even when tiling.
+ *
+ * If the resolution grew beyond what we kept, the image is loaded again.
+ * Hence, this is only done for images which can be loaded again, i.e. not for
+ * images read from stdin or --image-fd.
+ *
+ */
+static void fit_image_to_resolution(void) {
+    /* With --scaling, the whole image is needed to compute the image for
+     * each monitor. */
+    if (img == NULL || scaling_mode != SCALING_NONE || image_fd != -1 || image_path == NULL || strcmp(image_path, "-") == 0 ||
+        cairo_surface_get_type(img) != CAIRO_SURFACE_TYPE_IMAGE) {
         return;
     }
 
-    if (last_resolution[0] == geom->width &&
-        last_resolution[1] == geom->height) {
-        free(geom);
+    const int width = MIN(img_full_size[0], (int)last_resolution[0]);
+    const int height = MIN(img_full_size[1], (int)last_resolution[1]);
+    const int kept_width = cairo_image_surface_get_width(img);
+    const int kept_height = cairo_image_surface_get_height(img);
+    if (width == kept_width && height == kept_height) {
         return;
     }
 
-    last_resolution[0] = geom->width;
-    last_resolution[1] = geom->height;
-
-    free(geom);
-
-    redraw_screen();
-
-    uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-    xcb_configure_window(conn, win, mask, last_resolution);
-    xcb_flush(conn);
-
-    randr_query(screen->root);
-    redraw_screen();
-}
-
-static ssize_t read_raw_image_native(uint32_t *dest, FILE *src, size_t width, size_t height, int pixstride) {
-    ssize_t count = 0;
-    for (size_t y = 0; y < height; y++) {
-        size_t n = fread(&dest[y * pixstride], 1, width * 4, src);
-        count += n;
-        if (n < (size_t)(width * 4)) {
-            break;
+    const long rss_before = current_rss_kib();
+    if (width > kept_width || height > kept_height) {
+        DEBUG("resolution grew beyond the cropped image, loading it again\n");
+        cairo_surface_t *full = load_image(image_path, image_raw_format, NULL);
+        if (full == NULL) {
+            return;
         }
+        cairo_surface_destroy(img);
+        img = full;
     }
 
-    return count;
-}
-
-struct raw_pixel_format {
-    int bpp;
-    int red;
-    int green;
-    int blue;
-};
-
-static ssize_t read_raw_image_fmt(uint32_t *dest, FILE *src, size_t width, size_t height, int pixstride,
-                                  struct raw_pixel_format fmt) {
-    unsigned char *buf = malloc(width * fmt.bpp);
-    if (buf == NULL) {
-        return -1;
-    }
-
-    ssize_t count = 0;
-    for (size_t y = 0; y < height; y++) {
-        size_t n = fread(buf, 1, width * fmt.bpp, src);
-        count += n;
-        if (n < (size_t)(width * fmt.bpp)) {
-            break;
-        }
-
-        for (size_t x = 0; x < width; ++x) {
-            int idx = x * fmt.bpp;
-            dest[y * pixstride + x] = 0 |
-                                      (buf[idx + fmt.red]) << 16 |
-                                      (buf[idx + fmt.green]) << 8 |
-                                      (buf[idx + fmt.blue]);
-        }
+    cairo_surface_t *cropped = crop_image(img, width, height);
+    if (cropped == NULL) {
+        return;
     }
+    cairo_surface_destroy(img);
+    img = cropped;
 
-    free(buf);
-    return count;
+    DEBUG("cropped image from %d x %d to %d x %d px, RSS %ld KiB -> %ld KiB\n",
+          img_full_size[0], img_full_size[1], width, height, rss_before, current_rss_kib());
 }
 
-// Pre-defind pixel formats (<bytes per pixel>, <red pixel>, <green pixel>, <blue pixel>)
-static const struct raw_pixel_format raw_fmt_rgb = {3, 0, 1, 2};
-static const struct raw_pixel_format raw_fmt_rgbx = {4, 0, 1, 2};
-static const struct raw_pixel_format raw_fmt_xrgb = {4, 1, 2, 3};
-static const struct raw_pixel_format raw_fmt_bgr = {3, 2, 1, 0};
-static const struct raw_pixel_format raw_fmt_bgrx = {4, 2, 1, 0};
-static const struct raw_pixel_format raw_fmt_xbgr = {4, 3, 2, 1};
-
-static cairo_surface_t *read_raw_image(const char *image_path, const char *image_raw_format) {
-    cairo_surface_t *img;
-
-#define RAW_PIXFMT_MAXLEN 6
-#define STRINGIFY1(x) #x
-#define STRINGIFY(x) STRINGIFY1(x)
-    /* Parse format as <width>x<height>:<pixfmt> */
-    char pixfmt[RAW_PIXFMT_MAXLEN + 1];
-    size_t w, h;
-    const char *fmt = "%zux%zu:%" STRINGIFY(RAW_PIXFMT_MAXLEN) "s";
-    if (sscanf(image_raw_format, fmt, &w, &h, pixfmt) != 3) {
-        fprintf(stderr, "Invalid image format: \"%s\"\n", image_raw_format);
-        return NULL;
+/*
+ * Logs the startup milestones when the MapNotify for the lock window arrives,
+ * which is after the first frame was drawn and the keyboard and pointer were
+ * grabbed. With --startup-json, they are also written as a single line of
+ * JSON, so that scripts can compare startup times across versions and
+ * configurations.
+ *
+ */
+static void log_startup_time(void) {
+    static bool logged = false;
+    if (logged) {
+        return;
     }
-#undef RAW_PIXFMT_MAXLEN
-#undef STRINGIFY1
-#undef STRINGIFY
-
-    /* Create image surface */
-    img = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w, h);
-    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
-        fprintf(stderr, "Could not create surface: %s\n",
-                cairo_status_to_string(cairo_surface_status(img)));
-        return NULL;
+    logged = true;
+    metrics_set_since(METRIC_TIME_TO_LOCK, &startup_time);
+    const double map_notify_ms = elapsed_ms(&startup_time);
+    DEBUG("startup: image loaded after %.1f ms, first frame drawn after %.1f ms, "
+          "grabbed after %.1f ms, MapNotify after %.1f ms\n",
+          image_loaded_ms, first_frame_ms, grabbed_ms, map_notify_ms);
+
+    int fd = startup_json_fd;
+    if (startup_json_path != NULL &&
+        (fd = open(startup_json_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        fprintf(stderr, "[i3lock] Could not open %s: %s\n", startup_json_path, strerror(errno));
+        return;
     }
-    cairo_surface_flush(img);
-
-    /* Use uint32_t* because cairo uses native endianness */
-    uint32_t *data = (uint32_t *)cairo_image_surface_get_data(img);
-    const int pixstride = cairo_image_surface_get_stride(img) / 4;
-
-    FILE *f = fopen(image_path, "r");
-    if (f == NULL) {
-        fprintf(stderr, "Could not open image \"%s\": %s\n",
-                image_path, strerror(errno));
-        cairo_surface_destroy(img);
-        return NULL;
+    if (fd == -1) {
+        return;
     }
+    dprintf(fd, "{\"image_loaded_ms\": %.1f, \"first_frame_ms\": %.1f, \"grabbed_ms\": %.1f, \"map_notify_ms\": %.1f}\n",
+            image_loaded_ms, first_frame_ms, grabbed_ms, map_notify_ms);
+    close(fd);
+}
 
-    /* Read the image, respecting cairo's stride, according to the pixfmt */
-    ssize_t size, count;
-    if (strcmp(pixfmt, "native") == 0) {
-        /* If the pixfmt is 'native', just read each line directly into the buffer */
-        size = w * h * 4;
-        count = read_raw_image_native(data, f, w, h, pixstride);
+/*
+ * Loads the image (-i, --image-fd) or takes the screenshot (--blur,
+ * --pixelate). In case loading failed, img stays NULL and we just pretend no
+ * -i was specified.
+ *
+ * PNG and JPEG images are cached after decoding and fit_image_to_resolution(),
+ * so locking again with the same image and monitor layout only maps the
+ * cached pixels instead of decoding the image. The image is written to the
+ * cache once the screen is locked.
+ *
+ */
+static void load_background_image(void) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* When the image is scaled to each monitor, it never needs to be larger
+     * than the root window. Otherwise, it is shown unscaled. */
+    const bool scaled = (scaling_mode == SCALING_FILL || scaling_mode == SCALING_FIT ||
+                         scaling_mode == SCALING_STRETCH);
+
+    /* The geometry describes what happened to the decoded pixels, not how
+     * they are drawn: they are cropped to the root window without --scaling,
+     * (JPEGs) decoded at a size covering the root window when scaled, and
+     * kept as they are with --scaling=center. */
+    const bool cacheable = (image_fd == -1 && image_path != NULL && image_raw_format == NULL &&
+                            blur_radius == 0 && pixelate_size == 0);
+    char geometry[64];
+    if (scaling_mode == SCALING_CENTER) {
+        snprintf(geometry, sizeof(geometry), "full");
     } else {
-        const struct raw_pixel_format *fmt = NULL;
-
-        if (strcmp(pixfmt, "rgb") == 0) {
-            fmt = &raw_fmt_rgb;
-        } else if (strcmp(pixfmt, "rgbx") == 0) {
-            fmt = &raw_fmt_rgbx;
-        } else if (strcmp(pixfmt, "xrgb") == 0) {
-            fmt = &raw_fmt_xrgb;
-        } else if (strcmp(pixfmt, "bgr") == 0) {
-            fmt = &raw_fmt_bgr;
-        } else if (strcmp(pixfmt, "bgrx") == 0) {
-            fmt = &raw_fmt_bgrx;
-        } else if (strcmp(pixfmt, "xbgr") == 0) {
-            fmt = &raw_fmt_xbgr;
-        }
+        snprintf(geometry, sizeof(geometry), "%s=%" PRIu32 "x%" PRIu32,
+                 (scaled ? "cover" : "crop"), last_resolution[0], last_resolution[1]);
+    }
+    if (cacheable && (img = load_cached_image(image_path, geometry, img_full_size)) != NULL) {
+        DEBUG("loaded cached image in %.1f ms (cache hit)\n", elapsed_ms(&start));
+        return;
+    }
 
-        if (fmt == NULL) {
-            fprintf(stderr, "Unknown raw pixel format: %s\n", pixfmt);
-            fclose(f);
-            cairo_surface_destroy(img);
-            return NULL;
+    if (image_fd != -1) {
+        img = load_image_fd(image_fd, image_raw_format);
+    } else if (blur_radius > 0 || pixelate_size > 0) {
+        img = capture_screen();
+        if (img != NULL) {
+            apply_effects();
         }
-
-        size = w * h * fmt->bpp;
-        count = read_raw_image_fmt(data, f, w, h, pixstride, *fmt);
+    } else if (animation_dir != NULL) {
+        img = animation_init(animation_dir, image_raw_format, (scaled ? last_resolution : NULL), animation_fps);
+    } else {
+        img = load_image(image_path, image_raw_format, (scaled ? last_resolution : NULL));
     }
 
-    cairo_surface_mark_dirty(img);
+    if (img != NULL && image_size(img, &img_full_size[0], &img_full_size[1])) {
+        fit_image_to_resolution();
+    }
+    DEBUG("loaded image in %.1f ms%s\n", elapsed_ms(&start), (cacheable ? " (cache miss)" : ""));
 
-    if (count < size) {
-        if (count < 0 || ferror(f)) {
-            fprintf(stderr, "Failed to read image \"%s\": %s\n",
-                    image_path, strerror(errno));
-            fclose(f);
-            cairo_surface_destroy(img);
-            return NULL;
-        } else {
-            /* Print a warning if the file contains less data than expected,
-             * but don't abort. It's useful to see how the image looks even if it's wrong. */
-            fprintf(stderr, "Warning: expected to read %zi bytes from \"%s\", read %zi\n",
-                    size, image_path, count);
-        }
+    if (cacheable && img != NULL) {
+        store_cached_image(image_path, geometry, img, img_full_size);
     }
+}
 
-    fclose(f);
-    return img;
+/*
+ * With --low-memory, the image is freed once it is on the X server. When the
+ * screen layout changes, it is loaded again (usually from the cache).
+ *
+ */
+static void reload_background_image(void) {
+    if (!low_memory) {
+        return;
+    }
+    /* The slideshow loads the current image in the background. */
+    if (slideshow_reload()) {
+        return;
+    }
+    invalidate_background();
+    if (img == NULL) {
+        load_background_image();
+    }
 }
 
-static bool verify_png_image(const char *image_path) {
-    if (!image_path) {
-        return false;
+/*
+ * Called on SIGHUP: reads the images of the slideshow again, or loads the
+ * single image again (e.g. from the cache, if the file did not change). If
+ * that fails, the current image stays.
+ *
+ */
+static void handle_sighup(EV_P_ ev_signal *w, int revents) {
+    trace_instant("sighup");
+    if (slideshow_reread()) {
+        return;
+    }
+    if (image_path == NULL || image_fd != -1 || strcmp(image_path, "-") == 0) {
+        DEBUG("SIGHUP received, but there is no image file to load again\n");
+        return;
     }
+    DEBUG("SIGHUP received, loading %s again\n", image_path);
 
-    /* Check file exists and has correct PNG header */
-    FILE *png_file = fopen(image_path, "r");
-    if (png_file == NULL) {
-        fprintf(stderr, "Image file path \"%s\" cannot be opened: %s\n", image_path, strerror(errno));
-        return false;
+    cairo_surface_t *previous = img;
+    img = NULL;
+    load_background_image();
+    if (img == NULL) {
+        fprintf(stderr, "[i3lock] Could not load %s again, keeping the current image\n", image_path);
+        img = previous;
+        return;
     }
-    unsigned char png_header[8];
-    memset(png_header, '\0', sizeof(png_header));
-    int bytes_read = fread(png_header, 1, sizeof(png_header), png_file);
-    fclose(png_file);
-    if (bytes_read != sizeof(png_header)) {
-        fprintf(stderr, "Could not read PNG header from \"%s\"\n", image_path);
+    invalidate_background();
+    invalidate_scaled_images();
+    if (previous != NULL) {
+        cairo_surface_destroy(previous);
+    }
+    redraw_screen();
+}
+
+/*
+ * Called when the properties on the root window change, e.g. when the screen
+ * resolution changes. If so we update the window to cover the whole screen
+ * and also redraw the image, if any. Returns false if the resolution did not
+ * change.
+ *
+ */
+static bool _handle_screen_resize(void) {
+    xcb_get_geometry_cookie_t geomc;
+    xcb_get_geometry_reply_t *geom;
+    geomc = xcb_get_geometry(conn, screen->root);
+    if ((geom = ROUNDTRIP(xcb_get_geometry_reply(conn, geomc, 0))) == NULL) {
         return false;
     }
 
-    // Check PNG header according to the specification, available at:
-    // https://www.w3.org/TR/2003/REC-PNG-20031110/#5PNG-file-signature
-    static unsigned char PNG_REFERENCE_HEADER[8] = {137, 80, 78, 71, 13, 10, 26, 10};
-    if (memcmp(PNG_REFERENCE_HEADER, png_header, sizeof(png_header)) != 0) {
-        fprintf(stderr, "File \"%s\" does not start with a PNG header. i3lock currently only supports loading PNG files.\n", image_path);
+    if (last_resolution[0] == geom->width &&
+        last_resolution[1] == geom->height) {
+        free(geom);
         return false;
     }
+
+    last_resolution[0] = geom->width;
+    last_resolution[1] = geom->height;
+
+    free(geom);
+
+    /* The slideshow prepares images for the new resolution in the
+     * background. */
+    if (!slideshow_reload()) {
+        reload_background_image();
+        fit_image_to_resolution();
+    }
+    redraw_screen();
+
+    uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+    xcb_configure_window(conn, win, mask, last_resolution);
+    xcb_flush(conn);
+
+    randr_query(screen->root);
+    redraw_screen();
     return true;
 }
 
+static bool handle_screen_resize(void) {
+    PROBE(screen_resize_begin);
+    trace_begin("handle_screen_resize");
+    const roundtrip_phase_t previous = roundtrip_phase_enter(ROUNDTRIP_RESIZE);
+    watchdog_enter("handle_screen_resize");
+    const bool resized = _handle_screen_resize();
+    watchdog_leave();
+    roundtrip_phase_leave(previous);
+    trace_end("handle_screen_resize");
+    PROBE2(screen_resize_end, last_resolution[0], last_resolution[1]);
+    return resized;
+}
+
 #ifndef __OpenBSD__
 /*
  * Callback function for PAM. We only react on password request callbacks.
@@ -888,7 +1069,14 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
         errx(EXIT_FAILURE, "X11 connection broke, did your server terminate?");
     }
 
-    while ((event = xcb_poll_for_event(conn)) != NULL) {
+    /* Most wakeups are timers, which would only clutter the timeline with
+     * empty spans. */
+    if ((event = watchdog_poll_for_event(conn)) == NULL) {
+        return;
+    }
+
+    trace_begin("xcb_check_cb");
+    do {
         if (event->response_type == 0) {
             xcb_generic_error_t *error = (xcb_generic_error_t *)event;
             if (debug_mode) {
@@ -903,15 +1091,32 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
         int type = (event->response_type & 0x7F);
 
         switch (type) {
-            case XCB_KEY_PRESS:
+            case XCB_KEY_PRESS: {
+                PROBE(key_press_begin);
+                trace_begin("handle_key_press");
+                const roundtrip_phase_t previous = roundtrip_phase_enter(ROUNDTRIP_KEYSTROKE);
+                watchdog_enter("handle_key_press");
+                display_input();
                 handle_key_press((xcb_key_press_event_t *)event);
+                /* Not every key press draws (e.g. modifiers), but one which
+                 * turned the display on must replace the outdated frame. */
+                if (display_redraw_pending()) {
+                    redraw_screen();
+                }
+                watchdog_leave();
+                roundtrip_phase_leave(previous);
+                trace_end("handle_key_press");
+                PROBE(key_press_end);
                 break;
+            }
 
             case XCB_VISIBILITY_NOTIFY:
                 handle_visibility_notify(conn, (xcb_visibility_notify_event_t *)event);
                 break;
 
             case XCB_MAP_NOTIFY:
+                log_startup_time();
+                trace_instant("map_notify");
                 maybe_close_sleep_lock_fd();
                 if (!dont_fork) {
                     /* After the first MapNotify, we never fork again. We don’t
@@ -919,12 +1124,22 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
                     dont_fork = true;
 
                     /* In the parent process, we exit */
+                    trace_flush();
                     if (fork() != 0) {
                         exit(0);
                     }
 
                     ev_loop_fork(EV_DEFAULT);
                 }
+                /* Only now that we forked, threads can be started. */
+                start_raise_thread();
+                start_storing_cached_images();
+                if (animation_dir != NULL) {
+                    animation_start(main_loop);
+                }
+                if (image_path != NULL) {
+                    slideshow_start(main_loop);
+                }
                 break;
 
             case XCB_CONFIGURE_NOTIFY:
@@ -933,33 +1148,55 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
 
             default:
                 if (type == xkb_base_event) {
+                    trace_begin("process_xkb_event");
+                    watchdog_enter("process_xkb_event");
                     process_xkb_event(event);
+                    watchdog_leave();
+                    trace_end("process_xkb_event");
                     redraw_screen();
                 }
                 if (randr_base > -1 &&
                     type == randr_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+                    metrics_count(METRIC_RANDR_CHANGES);
+                    const roundtrip_phase_t previous = roundtrip_phase_enter(ROUNDTRIP_RESIZE);
                     randr_query(screen->root);
-                    handle_screen_resize();
+                    /* A new resolution reloads the image for it. When only
+                     * the monitors changed, the image is still needed to
+                     * draw the background for them (--low-memory). */
+                    if (!handle_screen_resize() && low_memory) {
+                        reload_background_image();
+                        redraw_screen();
+                    }
+                    roundtrip_phase_leave(previous);
+                }
+                if (screensaver_base > -1 &&
+                    type == screensaver_base + XCB_SCREENSAVER_NOTIFY) {
+                    display_handle_screensaver_notify((xcb_screensaver_notify_event_t *)event);
                 }
         }
 
         free(event);
-    }
+    } while ((event = watchdog_poll_for_event(conn)) != NULL);
+    trace_end("xcb_check_cb");
 }
 
 /*
- * This function is called from a fork()ed child and will raise the i3lock
- * window when the window is obscured, even when the main i3lock process is
- * blocked due to the authentication backend.
+ * This function runs in a separate thread (with its own X11 connection) and
+ * will raise the i3lock window when the window is obscured, even when the main
+ * thread is blocked due to the authentication backend.
  *
  */
-static void raise_loop(xcb_window_t window) {
+static void *raise_loop(void *arg) {
+    const xcb_window_t window = win;
     xcb_connection_t *conn;
     xcb_generic_event_t *event;
     int screens;
 
+    /* Failing here must not end i3lock, that would unlock the screen. */
     if (xcb_connection_has_error((conn = xcb_connect(NULL, &screens))) > 0) {
-        errx(EXIT_FAILURE, "Cannot open display");
+        fprintf(stderr, "Cannot open display, the i3lock window will not be raised when obscured\n");
+        xcb_disconnect(conn);
+        return NULL;
     }
 
     /* We need to know about the window being obscured or getting destroyed. */
@@ -988,13 +1225,17 @@ static void raise_loop(xcb_window_t window) {
             case XCB_UNMAP_NOTIFY:
                 DEBUG("UnmapNotify for 0x%08x\n", (((xcb_unmap_notify_event_t *)event)->window));
                 if (((xcb_unmap_notify_event_t *)event)->window == window) {
-                    exit(EXIT_SUCCESS);
+                    free(event);
+                    xcb_disconnect(conn);
+                    return NULL;
                 }
                 break;
             case XCB_DESTROY_NOTIFY:
                 DEBUG("DestroyNotify for 0x%08x\n", (((xcb_destroy_notify_event_t *)event)->window));
                 if (((xcb_destroy_notify_event_t *)event)->window == window) {
-                    exit(EXIT_SUCCESS);
+                    free(event);
+                    xcb_disconnect(conn);
+                    return NULL;
                 }
                 break;
             default:
@@ -1003,13 +1244,43 @@ static void raise_loop(xcb_window_t window) {
         }
         free(event);
     }
+    xcb_disconnect(conn);
+    return NULL;
+}
+
+/*
+ * Starts the thread which raises the i3lock window. Unlike a fork()ed child,
+ * the thread only needs its stack and X11 connection (about 100 KiB resident),
+ * while a child shares the image and everything else copy-on-write: every
+ * page either process modifies afterwards (e.g. when the background changes)
+ * is duplicated. Threads do not survive fork(), so this is called after i3lock
+ * forked into the background.
+ *
+ */
+static void start_raise_thread(void) {
+    static bool started = false;
+    if (started) {
+        return;
+    }
+    started = true;
+
+    const long rss_before = current_rss_kib();
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    /* The thread only waits for events, a small stack suffices. */
+    pthread_attr_setstacksize(&attr, RAISE_THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, raise_loop, NULL) != 0) {
+        fprintf(stderr, "Could not start the thread raising the i3lock window\n");
+    }
+    pthread_attr_destroy(&attr);
+    DEBUG("started raise thread, RSS %ld KiB -> %ld KiB\n", rss_before, current_rss_kib());
 }
 
 int main(int argc, char *argv[]) {
     struct passwd *pw;
     char *username;
-    char *image_path = NULL;
-    char *image_raw_format = NULL;
 #ifndef __OpenBSD__
     int ret;
     struct pam_conv conv = {conv_callback, NULL};
@@ -1029,13 +1300,29 @@ int main(int argc, char *argv[]) {
         {"no-unlock-indicator", no_argument, NULL, 'u'},
         {"image", required_argument, NULL, 'i'},
         {"raw", required_argument, NULL, 0},
+        {"image-fd", required_argument, NULL, 0},
         {"tiling", no_argument, NULL, 't'},
+        {"scaling", required_argument, NULL, 0},
+        {"blur", required_argument, NULL, 0},
+        {"pixelate", required_argument, NULL, 0},
+        {"animation", required_argument, NULL, 0},
+        {"animation-fps", required_argument, NULL, 0},
+        {"slideshow-interval", required_argument, NULL, 0},
+        {"timer-slack", required_argument, NULL, 0},
+        {"low-memory", no_argument, NULL, 0},
+        {"trace-file", required_argument, NULL, 0},
+        {"metrics-file", required_argument, NULL, 0},
+        {"stall-threshold", required_argument, NULL, 0},
+        {"startup-json", required_argument, NULL, 0},
+        {"benchmark", optional_argument, NULL, 0},
         {"ignore-empty-password", no_argument, NULL, 'e'},
         {"inactivity-timeout", required_argument, NULL, 'I'},
         {"show-failed-attempts", no_argument, NULL, 'f'},
         {"show-keyboard-layout", no_argument, NULL, 'k'},
         {NULL, no_argument, NULL, 0}};
 
+    clock_gettime(CLOCK_MONOTONIC, &startup_time);
+
     int code = EXIT_FAILURE;
     char *optstring = "hvnbdc:p:ui:teI:fk";
     while ((o = getopt_long(argc, argv, optstring, longopts, &longoptind)) != -1) {
@@ -1073,7 +1360,10 @@ int main(int argc, char *argv[]) {
                 unlock_indicator = false;
                 break;
             case 'i':
-                image_path = strdup(optarg);
+                if (image_path == NULL) {
+                    image_path = strdup(optarg);
+                }
+                slideshow_add(optarg);
                 break;
             case 't':
                 tile = true;
@@ -1095,6 +1385,88 @@ int main(int argc, char *argv[]) {
                     debug_mode = true;
                 } else if (strcmp(longopts[longoptind].name, "raw") == 0) {
                     image_raw_format = strdup(optarg);
+                } else if (strcmp(longopts[longoptind].name, "image-fd") == 0) {
+                    char *endptr;
+                    long fd = strtol(optarg, &endptr, 10);
+                    if (*optarg == '\0' || *endptr != '\0' || fd < 0 || fd > INT_MAX) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid image file descriptor \"%s\".", optarg);
+                    }
+                    image_fd = fd;
+                } else if (strcmp(longopts[longoptind].name, "blur") == 0 ||
+                           strcmp(longopts[longoptind].name, "pixelate") == 0) {
+                    char *endptr;
+                    long value = strtol(optarg, &endptr, 10);
+                    if (*optarg == '\0' || *endptr != '\0' || value < 1 || value > 1000) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid %s size \"%s\", expected 1 to 1000 pixels.",
+                             longopts[longoptind].name, optarg);
+                    }
+                    if (strcmp(longopts[longoptind].name, "blur") == 0) {
+                        blur_radius = value;
+                    } else {
+                        pixelate_size = value;
+                    }
+                } else if (strcmp(longopts[longoptind].name, "animation") == 0) {
+                    animation_dir = strdup(optarg);
+                } else if (strcmp(longopts[longoptind].name, "animation-fps") == 0) {
+                    char *endptr;
+                    long fps = strtol(optarg, &endptr, 10);
+                    if (*optarg == '\0' || *endptr != '\0' || fps < 1 || fps > 60) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid frame rate \"%s\", expected 1 to 60.", optarg);
+                    }
+                    animation_fps = fps;
+                } else if (strcmp(longopts[longoptind].name, "slideshow-interval") == 0) {
+                    char *endptr;
+                    double minutes = strtod(optarg, &endptr);
+                    if (*optarg == '\0' || *endptr != '\0' || !(minutes > 0) || minutes > 24 * 60) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid slideshow interval \"%s\", expected minutes.", optarg);
+                    }
+                    slideshow_interval = TSTAMP_N_MINS(minutes);
+                } else if (strcmp(longopts[longoptind].name, "low-memory") == 0) {
+                    low_memory = true;
+                } else if (strcmp(longopts[longoptind].name, "trace-file") == 0) {
+                    trace_path = optarg;
+                } else if (strcmp(longopts[longoptind].name, "metrics-file") == 0) {
+                    metrics_open(optarg);
+                } else if (strcmp(longopts[longoptind].name, "stall-threshold") == 0) {
+                    char *endptr;
+                    long ms = strtol(optarg, &endptr, 10);
+                    if (*optarg == '\0' || *endptr != '\0' || ms < 0 || ms > 10000) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid stall threshold \"%s\", expected 0 to 10000 ms.", optarg);
+                    }
+                    stall_threshold = ms / 1000.0;
+                } else if (strcmp(longopts[longoptind].name, "startup-json") == 0) {
+                    /* A number is a file descriptor, like for --image-fd. */
+                    char *endptr;
+                    long fd = strtol(optarg, &endptr, 10);
+                    if (*optarg != '\0' && *endptr == '\0') {
+                        if (fd < 0 || fd > INT_MAX) {
+                            errx(EXIT_FAILURE, "i3lock: Invalid startup JSON file descriptor \"%s\".", optarg);
+                        }
+                        startup_json_fd = fd;
+                    } else {
+                        startup_json_path = optarg;
+                    }
+                } else if (strcmp(longopts[longoptind].name, "benchmark") == 0) {
+                    benchmark_frames = 100;
+                    if (optarg != NULL) {
+                        char *endptr;
+                        long frames = strtol(optarg, &endptr, 10);
+                        if (*optarg == '\0' || *endptr != '\0' || frames < 1 || frames > 100000) {
+                            errx(EXIT_FAILURE, "i3lock: Invalid number of frames \"%s\", expected 1 to 100000.", optarg);
+                        }
+                        benchmark_frames = frames;
+                    }
+                } else if (strcmp(longopts[longoptind].name, "timer-slack") == 0) {
+                    char *endptr;
+                    long ms = strtol(optarg, &endptr, 10);
+                    if (*optarg == '\0' || *endptr != '\0' || ms < 0 || ms > 1000) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid timer slack \"%s\", expected 0 to 1000 ms.", optarg);
+                    }
+                    timer_slack = ms / 1000.0;
+                } else if (strcmp(longopts[longoptind].name, "scaling") == 0) {
+                    if (!parse_scaling_mode(optarg, &scaling_mode)) {
+                        errx(EXIT_FAILURE, "i3lock: Invalid scaling mode given. Expected one of \"none\", \"center\", \"fill\", \"fit\" or \"stretch\".");
+                    }
                 }
                 break;
             case 'f':
@@ -1112,6 +1484,30 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if ((blur_radius > 0 || pixelate_size > 0) && (image_path != NULL || image_fd != -1)) {
+        errx(EXIT_FAILURE, "i3lock: --blur and --pixelate use a screenshot and cannot be combined with -i or --image-fd.");
+    }
+    if (animation_dir != NULL && (image_path != NULL || image_fd != -1 || blur_radius > 0 || pixelate_size > 0)) {
+        errx(EXIT_FAILURE, "i3lock: --animation cannot be combined with -i, --image-fd, --blur or --pixelate.");
+    }
+    /* Expand directories and lists of images, see slideshow.c. */
+    if (image_path != NULL && image_fd == -1) {
+        free(image_path);
+        if ((image_path = slideshow_init(image_raw_format, slideshow_interval)) == NULL) {
+            errx(EXIT_FAILURE, "i3lock: Could not read the images given via -i.");
+        }
+    }
+    /* The image is loaded again when the layout changes, which is not possible
+     * for stdin, --image-fd or screenshots, and pointless for animations. */
+    if (low_memory && (image_fd != -1 || (image_path != NULL && strcmp(image_path, "-") == 0) ||
+                       blur_radius > 0 || pixelate_size > 0 || animation_dir != NULL)) {
+        errx(EXIT_FAILURE, "i3lock: --low-memory needs an image file given via -i.");
+    }
+
+    if (trace_path != NULL) {
+        trace_open(trace_path);
+    }
+
     if ((pw = getpwuid(getuid())) == NULL) {
         err(EXIT_FAILURE, "getpwuid() failed");
     }
@@ -1128,13 +1524,15 @@ int main(int argc, char *argv[]) {
 
 #ifndef __OpenBSD__
     /* Initialize PAM */
-    if ((ret = pam_start("i3lock", username, &conv, &pam_handle)) != PAM_SUCCESS) {
+    trace_begin("pam_start");
+    if ((ret = pam_start(I3LOCK_PAM_SERVICE, username, &conv, &pam_handle)) != PAM_SUCCESS) {
         errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
     }
 
     if ((ret = pam_set_item(pam_handle, PAM_TTY, getenv("DISPLAY"))) != PAM_SUCCESS) {
         errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
     }
+    trace_end("pam_start");
 #endif
 
 /* Using mlock() as non-super-user seems only possible in Linux.
@@ -1153,10 +1551,12 @@ int main(int argc, char *argv[]) {
 
     /* Double checking that connection is good and operatable with xcb */
     int screennr;
+    trace_begin("xcb_connect");
     if ((conn = xcb_connect(NULL, &screennr)) == NULL ||
         xcb_connection_has_error(conn)) {
         errx(EXIT_FAILURE, "Could not connect to X11, maybe you need to set DISPLAY?");
     }
+    trace_end("xcb_connect");
 
     if (xkb_x11_setup_xkb_extension(conn,
                                     XKB_X11_MIN_MAJOR_XKB_VERSION,
@@ -1212,14 +1612,19 @@ int main(int argc, char *argv[]) {
         locale = "C";
     }
 
+    trace_begin("load_compose_table");
     load_compose_table(locale);
+    trace_end("load_compose_table");
 
     screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
 
+    trace_begin("init_dpi");
     init_dpi();
+    trace_end("init_dpi");
 
     randr_init(&randr_base, screen->root);
     randr_query(screen->root);
+    display_init(&screensaver_base, screen->root);
 
     last_resolution[0] = screen->width_in_pixels;
     last_resolution[1] = screen->height_in_pixels;
@@ -1227,27 +1632,26 @@ int main(int argc, char *argv[]) {
     xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK,
                                  (uint32_t[]){XCB_EVENT_MASK_STRUCTURE_NOTIFY});
 
-    if (image_raw_format != NULL && image_path != NULL) {
-        /* Read image. 'read_raw_image' returns NULL on error,
-         * so we don't have to handle errors here. */
-        img = read_raw_image(image_path, image_raw_format);
-    } else if (verify_png_image(image_path)) {
-        /* Create a pixmap to render on, fill it with the background color */
-        img = cairo_image_surface_create_from_png(image_path);
-        /* In case loading failed, we just pretend no -i was specified. */
-        if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
-            fprintf(stderr, "Could not load image \"%s\": %s\n",
-                    image_path, cairo_status_to_string(cairo_surface_status(img)));
-            img = NULL;
-        }
+    trace_begin("load_background_image");
+    load_background_image();
+    trace_end("load_background_image");
+    image_loaded_ms = elapsed_ms(&startup_time);
+
+    if (benchmark_frames > 0) {
+        run_benchmark(benchmark_frames);
+        return 0;
     }
 
-    free(image_path);
-    free(image_raw_format);
+    /* SIGHUP would kill i3lock (and thereby unlock the screen) until the
+     * event loop handles it, see handle_sighup(). */
+    signal(SIGHUP, SIG_IGN);
 
     /* Pixmap on which the image is rendered to (if any) */
+    trace_begin("first_frame");
     xcb_pixmap_t bg_pixmap = create_bg_pixmap(conn, screen, last_resolution, color);
     draw_image(bg_pixmap, last_resolution);
+    trace_end("first_frame");
+    first_frame_ms = elapsed_ms(&startup_time);
 
     xcb_window_t stolen_focus = find_focused_window(conn, screen->root);
 
@@ -1259,6 +1663,7 @@ int main(int argc, char *argv[]) {
 
     /* Display the "locking…" message while trying to grab the pointer/keyboard. */
     auth_state = STATE_AUTH_LOCK;
+    trace_begin("grab");
     if (!grab_pointer_and_keyboard(conn, screen, cursor, 1000)) {
         DEBUG("stole focus from X11 window 0x%08x\n", stolen_focus);
 
@@ -1276,18 +1681,9 @@ int main(int argc, char *argv[]) {
             errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
         }
     }
-
-    pid_t pid = fork();
-    /* The pid == -1 case is intentionally ignored here:
-     * While the child process is useful for preventing other windows from
-     * popping up while i3lock blocks, it is not critical. */
-    if (pid == 0) {
-        /* Child */
-        close(xcb_get_file_descriptor(conn));
-        maybe_close_sleep_lock_fd();
-        raise_loop(win);
-        exit(EXIT_SUCCESS);
-    }
+    trace_end("grab");
+    grabbed_ms = elapsed_ms(&startup_time);
+    metrics_set_since(METRIC_TIME_TO_GRAB, &startup_time);
 
     /* Load the keymap again to sync the current modifier state. Since we first
      * loaded the keymap, there might have been changes, but starting from now,
@@ -1300,6 +1696,9 @@ int main(int argc, char *argv[]) {
     if (main_loop == NULL) {
         errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?");
     }
+    /* Timeouts are handled up to timer_slack late, so that libev handles the
+     * timeouts expiring within that time in one wakeup. */
+    ev_set_timeout_collect_interval(main_loop, timer_slack);
 
     /* Explicitly call the screen redraw in case "locking…" message was displayed */
     auth_state = STATE_AUTH_IDLE;
@@ -1318,11 +1717,26 @@ int main(int argc, char *argv[]) {
     ev_prepare_init(xcb_prepare, xcb_prepare_cb);
     ev_prepare_start(main_loop, xcb_prepare);
 
+    ev_signal_init(&sighup_watcher, handle_sighup, SIGHUP);
+    ev_signal_start(main_loop, &sighup_watcher);
+
+    display_start(main_loop);
+    metrics_start(main_loop);
+    watchdog_start(main_loop, conn, stall_threshold);
+
+    if (debug_mode) {
+        ev_timer_init(&wakeup_report_timer, report_wakeups, TSTAMP_N_MINS(1), TSTAMP_N_MINS(1));
+        ev_timer_start(main_loop, &wakeup_report_timer);
+    }
+
     /* Invoke the event callback once to catch all the events which were
      * received up until now. ev will only pick up new events (when the X11
      * file descriptor becomes readable). */
+    (void)roundtrip_phase_enter(ROUNDTRIP_IDLE);
     ev_invoke(main_loop, xcb_check, 0);
     ev_loop(main_loop, 0);
+    trace_close();
+    roundtrips_report();
 
 #ifndef __OpenBSD__
     if (pam_cleanup) {
@@ -1330,16 +1744,16 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
-    if (stolen_focus == XCB_NONE) {
-        return 0;
+    if (stolen_focus != XCB_NONE) {
+        DEBUG("restoring focus to X11 window 0x%08x\n", stolen_focus);
+        xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+        xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
+        xcb_destroy_window(conn, win);
+        set_focused_window(conn, screen->root, stolen_focus);
+        ROUNDTRIP(xcb_aux_sync(conn));
     }
 
-    DEBUG("restoring focus to X11 window 0x%08x\n", stolen_focus);
-    xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
-    xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
-    xcb_destroy_window(conn, win);
-    set_focused_window(conn, screen->root, stolen_focus);
-    xcb_aux_sync(conn);
-
+    metrics_set_since(METRIC_UNLOCK_TO_DESKTOP, &unlocked_at);
+    metrics_write();
     return 0;
 }
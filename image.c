@@ -0,0 +1,1196 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * image.c: loads the image given by -i, either as PNG, JPEG or as raw
+ *          pixels (--raw). Raw images in regular files are memory-mapped, all
+ *          others (e.g. stdin) are streamed into the image surface. Sealed
+ *          memfds (--image-fd) are passed on to the X server. For --blur
+ *          and --pixelate, the image is a screenshot instead.
+ *
+ */
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+#include <cairo/cairo-xcb.h>
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+#include "i3lock.h"
+#include "xcb.h"
+#include "image.h"
+#include "pixfmt.h"
+
+extern bool debug_mode;
+
+/*******************************************************************************
+ * Protection against files which are truncated while we use their mapping.
+ ******************************************************************************/
+
+/* Mappings which are used as image data without a copy. Accessing a page of
+ * such a mapping after the underlying file was truncated raises SIGBUS, which
+ * would kill i3lock and thereby unlock the screen. */
+#define MAX_GUARDED_MAPPINGS 8
+static struct image_mapping {
+    void *addr;
+    size_t len;
+} guarded_mappings[MAX_GUARDED_MAPPINGS];
+/* Images are also loaded by the animation thread. The signal handler only
+ * reads the table and must not take the lock. */
+static pthread_mutex_t guarded_mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sigbus_handler(int sig, siginfo_t *info, void *ucontext) {
+    char *addr = info->si_addr;
+    for (int i = 0; i < MAX_GUARDED_MAPPINGS; i++) {
+        struct image_mapping *m = &guarded_mappings[i];
+        if (m->addr == NULL || addr < (char *)m->addr || addr >= (char *)m->addr + m->len) {
+            continue;
+        }
+        /* Replace the whole mapping with zero-filled memory. The faulting
+         * access is restarted and the image will just show black. */
+        if (mmap(m->addr, m->len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+            return;
+        }
+    }
+
+    /* Not one of ours: restore the default action, which terminates us. */
+    signal(SIGBUS, SIG_DFL);
+    raise(SIGBUS);
+}
+
+static struct image_mapping *guard_mapping(void *addr, size_t len) {
+    static bool handler_installed = false;
+    struct image_mapping *result = NULL;
+    pthread_mutex_lock(&guarded_mappings_lock);
+    if (!handler_installed) {
+        struct sigaction action;
+        memset(&action, '\0', sizeof(action));
+        action.sa_sigaction = sigbus_handler;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGBUS, &action, NULL) != 0) {
+            pthread_mutex_unlock(&guarded_mappings_lock);
+            return NULL;
+        }
+        handler_installed = true;
+    }
+
+    for (int i = 0; i < MAX_GUARDED_MAPPINGS; i++) {
+        struct image_mapping *m = &guarded_mappings[i];
+        if (m->addr == NULL) {
+            m->len = len;
+            m->addr = addr;
+            result = m;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&guarded_mappings_lock);
+    return result;
+}
+
+static void unmap_image(void *data) {
+    struct image_mapping *m = data;
+    pthread_mutex_lock(&guarded_mappings_lock);
+    munmap(m->addr, m->len);
+    m->addr = NULL;
+    m->len = 0;
+    pthread_mutex_unlock(&guarded_mappings_lock);
+}
+
+static const cairo_user_data_key_t mapping_key;
+
+/*
+ * Wraps the given mapping of native pixels (RGB24 or ARGB32) in a cairo surface
+ * without copying it. The mapping is unmapped when the surface is destroyed.
+ *
+ */
+static cairo_surface_t *surface_for_mapping(unsigned char *addr, size_t len, cairo_format_t format,
+                                            size_t width, size_t height) {
+    struct image_mapping *m = guard_mapping(addr, len);
+    if (m == NULL) {
+        return NULL;
+    }
+
+    cairo_surface_t *img = cairo_image_surface_create_for_data(
+        addr, format, width, height, width * 4);
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data(img, &mapping_key, m, unmap_image) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(img);
+        pthread_mutex_lock(&guarded_mappings_lock);
+        m->addr = NULL;
+        pthread_mutex_unlock(&guarded_mappings_lock);
+        return NULL;
+    }
+    return img;
+}
+
+/*******************************************************************************
+ * Raw images (--raw).
+ ******************************************************************************/
+
+static cairo_surface_t *create_raw_surface(size_t width, size_t height) {
+    cairo_surface_t *img = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not create surface: %s\n",
+                cairo_status_to_string(cairo_surface_status(img)));
+        return NULL;
+    }
+    cairo_surface_flush(img);
+    return img;
+}
+
+static void warn_short_read(const char *image_path, ssize_t size, ssize_t count) {
+    /* Print a warning if the file contains less data than expected,
+     * but don't abort. It's useful to see how the image looks even if it's wrong. */
+    fprintf(stderr, "Warning: expected to read %zi bytes from \"%s\", read %zi\n",
+            size, image_path, count);
+}
+
+static pixfmt_convert_t select_converter(const struct raw_pixel_format *fmt) {
+    DEBUG("converting %s pixels using the %s implementation\n",
+          fmt->name, pixfmt_impl_name(pixfmt_best_impl()));
+    return raw_pixel_format_converter(fmt);
+}
+
+/*
+ * Reads up to len bytes from fd, retrying on short reads (as they happen on
+ * pipes) until either len bytes were read or end of file is reached. Returns
+ * the amount of bytes read, or -1 on error.
+ *
+ */
+static ssize_t read_fully(int fd, unsigned char *buf, size_t len) {
+    size_t count = 0;
+    while (count < len) {
+        ssize_t n = read(fd, buf + count, len - count);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        count += n;
+    }
+    return count;
+}
+
+/*
+ * Reads a raw image from a file descriptor which cannot be mapped, e.g. a
+ * pipe on stdin. The pixels are read in batches of rows and each batch is
+ * converted as soon as it arrives, so that converting overlaps with the
+ * producer writing the next rows.
+ *
+ */
+static cairo_surface_t *read_raw_image_stream(int fd, const char *image_path, size_t w, size_t h,
+                                              const struct raw_pixel_format *fmt) {
+    cairo_surface_t *img = create_raw_surface(w, h);
+    if (img == NULL) {
+        return NULL;
+    }
+
+    unsigned char *data = cairo_image_surface_get_data(img);
+    const size_t stride = cairo_image_surface_get_stride(img);
+    const size_t row_size = w * (fmt == NULL ? 4 : fmt->bpp);
+    const ssize_t size = row_size * h;
+    ssize_t count = 0;
+
+    if (fmt == NULL && stride == row_size) {
+        /* Native pixels without padding can be read directly into the
+         * surface in one go. */
+        count = read_fully(fd, data, size);
+    } else if (row_size > 0) {
+        /* Read about 1 MiB worth of rows at a time. */
+        const size_t batch_rows = (row_size < (1 << 20) ? (1 << 20) / row_size : 1);
+        unsigned char *buf = malloc(batch_rows * row_size);
+        if (buf == NULL) {
+            cairo_surface_destroy(img);
+            return NULL;
+        }
+        pixfmt_convert_t convert = (fmt == NULL ? NULL : select_converter(fmt));
+
+        size_t y = 0;
+        while (y < h) {
+            const size_t rows = (h - y < batch_rows ? h - y : batch_rows);
+            ssize_t n = read_fully(fd, buf, rows * row_size);
+            if (n == -1) {
+                count = -1;
+                break;
+            }
+            count += n;
+
+            /* Only complete rows are converted, a partial row at the end of
+             * a short image is left black. */
+            for (size_t r = 0; r < (size_t)n / row_size; r++, y++) {
+                if (convert == NULL) {
+                    memcpy(data + y * stride, buf + r * row_size, row_size);
+                } else {
+                    convert((uint32_t *)(data + y * stride), buf + r * row_size, w);
+                }
+            }
+            if ((size_t)n < rows * row_size) {
+                break;
+            }
+        }
+        free(buf);
+    }
+
+    cairo_surface_mark_dirty(img);
+
+    if (count < size) {
+        if (count < 0) {
+            fprintf(stderr, "Failed to read image \"%s\": %s\n",
+                    image_path, strerror(errno));
+            cairo_surface_destroy(img);
+            return NULL;
+        }
+        warn_short_read(image_path, size, count);
+    }
+
+    return img;
+}
+
+/*
+ * Reads a raw image from a regular file by mapping it into memory. Returns
+ * false if the file cannot be mapped, in which case the caller should fall
+ * back to read_raw_image_stream(). Otherwise, *result is set to the image
+ * (or NULL on error).
+ *
+ * If the file contains native pixels with the row stride cairo expects, the
+ * mapping itself becomes the image data. Otherwise, the pixels are converted
+ * straight from the mapping into a new surface.
+ *
+ */
+static bool read_raw_image_mmap(int fd, const char *image_path, size_t w, size_t h,
+                                const struct raw_pixel_format *fmt, cairo_surface_t **result) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return false;
+    }
+
+    const size_t bpp = (fmt == NULL ? 4 : fmt->bpp);
+    const size_t size = w * h * bpp;
+    const size_t len = st.st_size;
+    unsigned char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        DEBUG("Could not map \"%s\", reading it instead: %s\n", image_path, strerror(errno));
+        return false;
+    }
+
+    if (fmt == NULL && len >= size &&
+        cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, w) == (int)(w * 4)) {
+        /* Start reading the file in the background, the first paint of the
+         * image will need all of it. */
+        madvise(map, len, MADV_WILLNEED);
+        if ((*result = surface_for_mapping(map, len, CAIRO_FORMAT_RGB24, w, h)) != NULL) {
+            DEBUG("Using the mapping of \"%s\" as image data\n", image_path);
+            return true;
+        }
+    }
+
+    cairo_surface_t *img = create_raw_surface(w, h);
+    if (img == NULL) {
+        munmap(map, len);
+        *result = NULL;
+        return true;
+    }
+
+    madvise(map, len, MADV_SEQUENTIAL);
+
+    unsigned char *data = cairo_image_surface_get_data(img);
+    const int stride = cairo_image_surface_get_stride(img);
+    const size_t row_size = w * bpp;
+    const size_t rows = (row_size == 0 ? h : (len < size ? len / row_size : h));
+
+    if (fmt == NULL) {
+        for (size_t y = 0; y < rows; y++) {
+            memcpy(data + y * stride, map + y * row_size, row_size);
+        }
+    } else {
+        pixfmt_convert_t convert = select_converter(fmt);
+        for (size_t y = 0; y < rows; y++) {
+            convert((uint32_t *)(data + y * stride), map + y * row_size, w);
+        }
+    }
+
+    cairo_surface_mark_dirty(img);
+    munmap(map, len);
+
+    if (len < size) {
+        warn_short_read(image_path, size, len);
+    }
+
+    *result = img;
+    return true;
+}
+
+/*
+ * Parses the --raw argument, <width>x<height>:<pixfmt>. The 'native' pixfmt is
+ * represented by a NULL *raw_fmt.
+ *
+ */
+static bool parse_raw_format(const char *image_raw_format, size_t *w, size_t *h,
+                             const struct raw_pixel_format **raw_fmt) {
+#define RAW_PIXFMT_MAXLEN 6
+#define STRINGIFY1(x) #x
+#define STRINGIFY(x) STRINGIFY1(x)
+    /* Parse format as <width>x<height>:<pixfmt> */
+    char pixfmt[RAW_PIXFMT_MAXLEN + 1];
+    const char *fmt = "%zux%zu:%" STRINGIFY(RAW_PIXFMT_MAXLEN) "s";
+    if (sscanf(image_raw_format, fmt, w, h, pixfmt) != 3) {
+        fprintf(stderr, "Invalid image format: \"%s\"\n", image_raw_format);
+        return false;
+    }
+#undef RAW_PIXFMT_MAXLEN
+#undef STRINGIFY1
+#undef STRINGIFY
+
+    *raw_fmt = NULL;
+    if (strcmp(pixfmt, "native") != 0) {
+        *raw_fmt = raw_pixel_format_by_name(pixfmt);
+        if (*raw_fmt == NULL) {
+            fprintf(stderr, "Unknown raw pixel format: %s\n", pixfmt);
+            return false;
+        }
+    }
+    return true;
+}
+
+static cairo_surface_t *read_raw_image(const char *image_path, const char *image_raw_format) {
+    size_t w, h;
+    const struct raw_pixel_format *raw_fmt;
+    if (!parse_raw_format(image_raw_format, &w, &h, &raw_fmt)) {
+        return NULL;
+    }
+
+    /* "-" means the image is read from stdin, e.g. piped from a screenshot
+     * tool, so that no temporary file is needed. */
+    const bool from_stdin = (strcmp(image_path, "-") == 0);
+    int fd = (from_stdin ? STDIN_FILENO : open(image_path, O_RDONLY | O_CLOEXEC));
+    if (fd == -1) {
+        fprintf(stderr, "Could not open image \"%s\": %s\n",
+                image_path, strerror(errno));
+        return NULL;
+    }
+
+    cairo_surface_t *img;
+    if (!read_raw_image_mmap(fd, image_path, w, h, raw_fmt, &img)) {
+        img = read_raw_image_stream(fd, image_path, w, h, raw_fmt);
+    }
+
+    if (!from_stdin) {
+        close(fd);
+    }
+    return img;
+}
+
+/* The pixmap behind an image passed via MIT-SHM. cairo cannot tell the size
+ * of an XCB surface, so we remember it here, too. */
+struct server_image {
+    xcb_pixmap_t pixmap;
+    int width;
+    int height;
+};
+static const cairo_user_data_key_t server_image_key;
+
+static void free_server_image(void *data) {
+    struct server_image *server_image = data;
+    xcb_free_pixmap(conn, server_image->pixmap);
+    free(server_image);
+}
+
+/*
+ * Returns true if the contents of the memfd cannot change anymore, i.e. the
+ * file can neither be written to nor shrunk.
+ *
+ */
+static bool is_sealed(int fd) {
+#ifdef F_GET_SEALS
+    const int required = F_SEAL_SHRINK | F_SEAL_WRITE;
+    const int seals = fcntl(fd, F_GET_SEALS);
+    return (seals != -1 && (seals & required) == required);
+#else
+    return false;
+#endif
+}
+
+/*
+ * Loads a raw image (in the given --raw format) from an already opened file
+ * descriptor, typically a sealed memfd filled by a long-running daemon.
+ *
+ * For native pixels in a sealed memfd, the file descriptor is handed to the X
+ * server via MIT-SHM and the resulting image is a server-side pixmap, so the
+ * pixels are never copied by i3lock. Everything else is loaded like a file.
+ *
+ */
+cairo_surface_t *load_image_fd(int fd, const char *image_raw_format) {
+    size_t w, h;
+    const struct raw_pixel_format *raw_fmt;
+    if (image_raw_format == NULL) {
+        fprintf(stderr, "--image-fd requires --raw\n");
+        close(fd);
+        return NULL;
+    }
+    if (!parse_raw_format(image_raw_format, &w, &h, &raw_fmt)) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Could not stat image fd %d: %s\n", fd, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    /* The seals guarantee that the server (and we) can keep using the memory
+     * without the contents changing or the mapping being truncated. */
+    int shm_fd;
+    if (raw_fmt == NULL && is_sealed(fd) &&
+        w > 0 && h > 0 && w <= UINT16_MAX && h <= UINT16_MAX &&
+        (size_t)st.st_size >= w * h * 4 &&
+        (shm_fd = dup(fd)) != -1) {
+        xcb_pixmap_t pixmap = create_pixmap_from_shm_fd(conn, screen, shm_fd, w, h);
+        if (pixmap != XCB_NONE) {
+            close(fd);
+            struct server_image *server_image = malloc(sizeof(struct server_image));
+            if (server_image == NULL) {
+                xcb_free_pixmap(conn, pixmap);
+                return NULL;
+            }
+            server_image->pixmap = pixmap;
+            server_image->width = w;
+            server_image->height = h;
+            cairo_surface_t *img = cairo_xcb_surface_create(conn, pixmap, get_root_visual_type(screen), w, h);
+            if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS ||
+                cairo_surface_set_user_data(img, &server_image_key, server_image,
+                                            free_server_image) != CAIRO_STATUS_SUCCESS) {
+                fprintf(stderr, "Could not create surface: %s\n",
+                        cairo_status_to_string(cairo_surface_status(img)));
+                cairo_surface_destroy(img);
+                free_server_image(server_image);
+                return NULL;
+            }
+            DEBUG("Passed image fd %d to the X server via MIT-SHM\n", fd);
+            return img;
+        }
+        DEBUG("Could not pass image fd %d via MIT-SHM, mapping it instead\n", fd);
+    } else {
+        DEBUG("Image fd %d is not a sealed memfd with native pixels, mapping it instead\n", fd);
+    }
+
+    cairo_surface_t *img;
+    if (!read_raw_image_mmap(fd, "(image fd)", w, h, raw_fmt, &img)) {
+        img = read_raw_image_stream(fd, "(image fd)", w, h, raw_fmt);
+    }
+    close(fd);
+    return img;
+}
+
+bool image_size(cairo_surface_t *img, int *width, int *height) {
+    if (cairo_surface_get_type(img) == CAIRO_SURFACE_TYPE_IMAGE) {
+        *width = cairo_image_surface_get_width(img);
+        *height = cairo_image_surface_get_height(img);
+        return true;
+    }
+    const struct server_image *server_image = cairo_surface_get_user_data(img, &server_image_key);
+    if (server_image == NULL) {
+        return false;
+    }
+    *width = server_image->width;
+    *height = server_image->height;
+    return true;
+}
+
+/*******************************************************************************
+ * Screenshots (--blur, --pixelate).
+ ******************************************************************************/
+
+/*
+ * Captures the current contents of the screen. If possible, the X server
+ * writes the pixels directly into a memfd which is then used as the image’s
+ * memory. Returns NULL on error.
+ *
+ */
+cairo_surface_t *capture_screen(void) {
+    const size_t w = screen->width_in_pixels;
+    const size_t h = screen->height_in_pixels;
+    const size_t len = w * h * 4;
+    cairo_surface_t *img = NULL;
+    int fd = -1;
+
+#ifdef MFD_CLOEXEC
+    if ((fd = memfd_create("i3lock-screenshot", MFD_CLOEXEC)) != -1 && ftruncate(fd, len) == 0) {
+        void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED && (img = surface_for_mapping(addr, len, CAIRO_FORMAT_RGB24, w, h)) == NULL) {
+            munmap(addr, len);
+        }
+    }
+#endif
+    if (img == NULL) {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+        if ((img = create_raw_surface(w, h)) == NULL) {
+            return NULL;
+        }
+    }
+
+    if (!get_root_image(conn, screen, fd, (uint32_t *)cairo_image_surface_get_data(img), w, h)) {
+        cairo_surface_destroy(img);
+        img = NULL;
+    } else {
+        cairo_surface_mark_dirty(img);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    return img;
+}
+
+/*******************************************************************************
+ * PNG images.
+ ******************************************************************************/
+
+typedef enum {
+    IMAGE_FORMAT_UNKNOWN = 0,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_JPEG,
+} image_format_t;
+
+/*
+ * Determines the format of the image file from its first bytes.
+ *
+ */
+static image_format_t sniff_image_format(const char *image_path) {
+    if (!image_path) {
+        return IMAGE_FORMAT_UNKNOWN;
+    }
+
+    /* Check file exists and has a known header */
+    FILE *image_file = fopen(image_path, "r");
+    if (image_file == NULL) {
+        fprintf(stderr, "Image file path \"%s\" cannot be opened: %s\n", image_path, strerror(errno));
+        return IMAGE_FORMAT_UNKNOWN;
+    }
+    unsigned char header[8];
+    memset(header, '\0', sizeof(header));
+    int bytes_read = fread(header, 1, sizeof(header), image_file);
+    fclose(image_file);
+    if (bytes_read != sizeof(header)) {
+        fprintf(stderr, "Could not read image header from \"%s\"\n", image_path);
+        return IMAGE_FORMAT_UNKNOWN;
+    }
+
+    // Check PNG header according to the specification, available at:
+    // https://www.w3.org/TR/2003/REC-PNG-20031110/#5PNG-file-signature
+    static unsigned char PNG_REFERENCE_HEADER[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (memcmp(PNG_REFERENCE_HEADER, header, sizeof(PNG_REFERENCE_HEADER)) == 0) {
+        return IMAGE_FORMAT_PNG;
+    }
+    // JPEG files start with an SOI marker, followed by another marker.
+    static unsigned char JPEG_REFERENCE_HEADER[3] = {0xFF, 0xD8, 0xFF};
+    if (memcmp(JPEG_REFERENCE_HEADER, header, sizeof(JPEG_REFERENCE_HEADER)) == 0) {
+        return IMAGE_FORMAT_JPEG;
+    }
+
+    fprintf(stderr, "File \"%s\" does not start with a PNG or JPEG header. i3lock currently only supports loading PNG and JPEG files.\n", image_path);
+    return IMAGE_FORMAT_UNKNOWN;
+}
+
+static cairo_surface_t *read_png_image(const char *image_path) {
+    cairo_surface_t *img = cairo_image_surface_create_from_png(image_path);
+    /* In case loading failed, we just pretend no -i was specified. */
+    if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not load image \"%s\": %s\n",
+                image_path, cairo_status_to_string(cairo_surface_status(img)));
+        cairo_surface_destroy(img);
+        return NULL;
+    }
+    return img;
+}
+
+/*******************************************************************************
+ * JPEG images.
+ ******************************************************************************/
+
+#ifdef HAVE_LIBJPEG
+struct jpeg_error_handler {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+/* libjpeg calls exit() on errors by default. */
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    struct jpeg_error_handler *handler = (struct jpeg_error_handler *)cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(handler->jmp, 1);
+}
+
+/*
+ * Decodes the JPEG image at image_path. If min_size is not NULL, the image is
+ * decoded at the smallest scale (in steps of 1/8) at which it still covers
+ * min_size, which libjpeg does much faster than decoding the full image.
+ *
+ */
+static cairo_surface_t *read_jpeg_image(const char *image_path, const uint32_t min_size[2]) {
+    FILE *jpeg_file = fopen(image_path, "rb");
+    if (jpeg_file == NULL) {
+        fprintf(stderr, "Could not open image \"%s\": %s\n", image_path, strerror(errno));
+        return NULL;
+    }
+
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_handler handler;
+    cairo_surface_t *volatile img = NULL;
+    unsigned char *volatile row = NULL;
+    cinfo.err = jpeg_std_error(&handler.pub);
+    handler.pub.error_exit = jpeg_error_exit;
+    if (setjmp(handler.jmp)) {
+        fprintf(stderr, "Could not load image \"%s\"\n", image_path);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(jpeg_file);
+        if (img != NULL) {
+            cairo_surface_destroy(img);
+        }
+        free(row);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, jpeg_file);
+    jpeg_read_header(&cinfo, TRUE);
+
+    cinfo.scale_denom = 8;
+    for (cinfo.scale_num = (min_size != NULL ? 1 : 8); cinfo.scale_num < 8; cinfo.scale_num++) {
+        jpeg_calc_output_dimensions(&cinfo);
+        if (cinfo.output_width >= min_size[0] && cinfo.output_height >= min_size[1]) {
+            break;
+        }
+    }
+
+    /* libjpeg-turbo can write pixels in cairo’s format directly. */
+#ifdef JCS_EXTENSIONS
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    cinfo.out_color_space = JCS_EXT_BGRX;
+#else
+    cinfo.out_color_space = JCS_EXT_XRGB;
+#endif
+    const bool native = true;
+#else
+    cinfo.out_color_space = JCS_RGB;
+    const bool native = false;
+#endif
+    jpeg_start_decompress(&cinfo);
+
+    if ((img = create_raw_surface(cinfo.output_width, cinfo.output_height)) == NULL) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(jpeg_file);
+        return NULL;
+    }
+    unsigned char *data = cairo_image_surface_get_data(img);
+    const int stride = cairo_image_surface_get_stride(img);
+
+    if (native) {
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW rows[4];
+            const JDIMENSION remaining = cinfo.output_height - cinfo.output_scanline;
+            const JDIMENSION count = (remaining < 4 ? remaining : 4);
+            for (JDIMENSION i = 0; i < count; i++) {
+                rows[i] = data + (size_t)(cinfo.output_scanline + i) * stride;
+            }
+            jpeg_read_scanlines(&cinfo, rows, count);
+        }
+    } else {
+        pixfmt_convert_t convert = select_converter(&raw_fmt_rgb);
+        if ((row = malloc((size_t)cinfo.output_width * 3)) == NULL) {
+            fprintf(stderr, "Could not allocate memory to decode \"%s\"\n", image_path);
+            jpeg_destroy_decompress(&cinfo);
+            fclose(jpeg_file);
+            cairo_surface_destroy(img);
+            return NULL;
+        }
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW rows[1] = {row};
+            const JDIMENSION y = cinfo.output_scanline;
+            jpeg_read_scanlines(&cinfo, rows, 1);
+            convert((uint32_t *)(data + (size_t)y * stride), row, cinfo.output_width);
+        }
+        free(row);
+    }
+
+    cairo_surface_mark_dirty(img);
+    DEBUG("Decoded \"%s\" at %d/8 scale: %d x %d px\n",
+          image_path, cinfo.scale_num, cinfo.output_width, cinfo.output_height);
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(jpeg_file);
+    return img;
+}
+#endif
+
+/*
+ * Returns a copy of the top-left width x height pixels of img, or NULL on
+ * error.
+ *
+ */
+cairo_surface_t *crop_image(cairo_surface_t *img, int width, int height) {
+    cairo_surface_t *cropped = cairo_surface_create_similar_image(
+        img, cairo_image_surface_get_format(img), width, height);
+    if (cairo_surface_status(cropped) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(cropped);
+        return NULL;
+    }
+
+    cairo_t *ctx = cairo_create(cropped);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(ctx, img, 0, 0);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+
+    return cropped;
+}
+
+/*
+ * Loads the image at image_path, either as raw image in the given format (if
+ * image_raw_format is not NULL) or as PNG or JPEG, depending on the file’s
+ * header. Returns NULL on error (after printing a message), in which case
+ * i3lock pretends no image was specified.
+ *
+ * If min_size is not NULL, the image only needs to cover min_size pixels,
+ * e.g. because it will be scaled down anyway. JPEG images are then decoded at
+ * a reduced resolution.
+ *
+ */
+cairo_surface_t *load_image(const char *image_path, const char *image_raw_format, const uint32_t min_size[2]) {
+    cairo_surface_t *img = NULL;
+
+    if (image_raw_format == NULL && image_path != NULL && strcmp(image_path, "-") == 0) {
+        fprintf(stderr, "Reading the image from stdin requires --raw\n");
+    } else if (image_raw_format != NULL && image_path != NULL) {
+        /* Read image. 'read_raw_image' returns NULL on error,
+         * so we don't have to handle errors here. */
+        img = read_raw_image(image_path, image_raw_format);
+    } else {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        const image_format_t format = sniff_image_format(image_path);
+        switch (format) {
+            case IMAGE_FORMAT_PNG:
+                img = read_png_image(image_path);
+                break;
+            case IMAGE_FORMAT_JPEG:
+#ifdef HAVE_LIBJPEG
+                img = read_jpeg_image(image_path, min_size);
+#else
+                fprintf(stderr, "Could not load image \"%s\": i3lock was built without JPEG support\n", image_path);
+#endif
+                break;
+            default:
+                break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (img != NULL) {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            DEBUG("Decoded %s image \"%s\" in %.1f ms, peak RSS %ld KiB\n",
+                  (format == IMAGE_FORMAT_PNG ? "PNG" : "JPEG"), image_path,
+                  (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+                  usage.ru_maxrss);
+        }
+    }
+
+    return img;
+}
+
+/*******************************************************************************
+ * Cache of decoded images.
+ ******************************************************************************/
+
+/* Decoding a large PNG takes much longer than mapping the decoded pixels, so
+ * decoded images are kept in $XDG_CACHE_HOME/i3lock. Each entry holds the
+ * pixels, followed by a trailer. */
+#define CACHE_MAGIC "i3lockC1"
+/* Only the most recently used entries are kept, as many as fit into both
+ * limits. */
+#define MAX_CACHE_ENTRIES 8
+#define MAX_CACHE_BYTES (256 * 1024 * 1024)
+
+struct cache_trailer {
+    char magic[8];
+    uint64_t key;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t full_width;
+    uint32_t full_height;
+    uint32_t padding;
+};
+
+/*
+ * Stores the path of the cache directory in dir. Returns false if neither
+ * $XDG_CACHE_HOME nor $HOME is set.
+ *
+ */
+static bool cache_dir(char *dir, size_t len) {
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int written;
+    if (xdg_cache_home != NULL && xdg_cache_home[0] == '/') {
+        written = snprintf(dir, len, "%s/i3lock", xdg_cache_home);
+    } else if (home != NULL && home[0] == '/') {
+        written = snprintf(dir, len, "%s/.cache/i3lock", home);
+    } else {
+        return false;
+    }
+    return (written > 0 && (size_t)written < len);
+}
+
+/*
+ * Computes the key of the cache entry for image_path (identified by its
+ * canonical path, size and modification time) at the given geometry.
+ * Returns false if the image cannot be found.
+ *
+ */
+static bool cache_key(const char *image_path, const char *geometry, uint64_t *key) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (realpath(image_path, path) == NULL || stat(path, &st) != 0) {
+        return false;
+    }
+
+    char buf[PATH_MAX + 128];
+    const int len = snprintf(buf, sizeof(buf), "%s|%lld|%lld.%09ld|%s",
+                             path, (long long)st.st_size,
+                             (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, geometry);
+    if (len < 0 || (size_t)len >= sizeof(buf)) {
+        return false;
+    }
+
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)buf[i]) * 0x100000001b3ULL;
+    }
+    *key = hash;
+    return true;
+}
+
+static bool cache_entry_path(uint64_t key, char *path, size_t len) {
+    char dir[PATH_MAX];
+    if (!cache_dir(dir, sizeof(dir))) {
+        return false;
+    }
+    const int written = snprintf(path, len, "%s/%016" PRIx64 ".img", dir, key);
+    return (written > 0 && (size_t)written < len);
+}
+
+cairo_surface_t *load_cached_image(const char *image_path, const char *geometry, int full_size[2]) {
+    uint64_t key;
+    char path[PATH_MAX];
+    if (!cache_key(image_path, geometry, &key) || !cache_entry_path(key, path, sizeof(path))) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        DEBUG("No cached image for \"%s\" at %s\n", image_path, geometry);
+        return NULL;
+    }
+
+    struct stat st;
+    struct cache_trailer trailer;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(trailer) ||
+        pread(fd, &trailer, sizeof(trailer), st.st_size - sizeof(trailer)) != sizeof(trailer) ||
+        memcmp(trailer.magic, CACHE_MAGIC, sizeof(trailer.magic)) != 0 || trailer.key != key ||
+        (trailer.format != CAIRO_FORMAT_RGB24 && trailer.format != CAIRO_FORMAT_ARGB32) ||
+        trailer.width == 0 || trailer.height == 0 || trailer.width > INT16_MAX || trailer.height > INT16_MAX ||
+        cairo_format_stride_for_width(trailer.format, trailer.width) != (int)(trailer.width * 4) ||
+        (size_t)st.st_size != (size_t)trailer.width * trailer.height * 4 + sizeof(trailer)) {
+        DEBUG("Ignoring invalid cache entry %s\n", path);
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    const size_t len = st.st_size;
+    unsigned char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, len, MADV_WILLNEED);
+
+    cairo_surface_t *img = surface_for_mapping(map, len, (cairo_format_t)trailer.format, trailer.width, trailer.height);
+    if (img == NULL) {
+        munmap(map, len);
+        return NULL;
+    }
+
+    /* The modification time of the entry tells how recently it was used. */
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    full_size[0] = trailer.full_width;
+    full_size[1] = trailer.full_height;
+    DEBUG("Using cached image %s for \"%s\"\n", path, image_path);
+    return img;
+}
+
+struct cache_entry {
+    char name[NAME_MAX + 1];
+    struct timespec mtime;
+    off_t size;
+};
+
+static int compare_cache_entries(const void *a, const void *b) {
+    const struct cache_entry *x = a, *y = b;
+    /* Most recently used first. */
+    if (x->mtime.tv_sec != y->mtime.tv_sec) {
+        return (x->mtime.tv_sec < y->mtime.tv_sec ? 1 : -1);
+    }
+    return (x->mtime.tv_nsec < y->mtime.tv_nsec ? 1 : (x->mtime.tv_nsec > y->mtime.tv_nsec ? -1 : 0));
+}
+
+/*
+ * Deletes all but the most recently used cache entries, keeping at most
+ * MAX_CACHE_ENTRIES entries of at most MAX_CACHE_BYTES in total. Entries for
+ * images which changed or for previous monitor layouts are never used again,
+ * so they are evicted eventually.
+ *
+ */
+static void evict_cache_entries(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+    const int dir_fd = dirfd(d);
+
+    struct cache_entry *entries = NULL;
+    size_t num_entries = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        const size_t len = strlen(ent->d_name);
+        struct stat st;
+        if (len < 4 || strcmp(ent->d_name + len - 4, ".img") != 0 ||
+            fstatat(dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        struct cache_entry *tmp = realloc(entries, (num_entries + 1) * sizeof(struct cache_entry));
+        if (tmp == NULL) {
+            break;
+        }
+        entries = tmp;
+        memcpy(entries[num_entries].name, ent->d_name, len + 1);
+        entries[num_entries].mtime = st.st_mtim;
+        entries[num_entries].size = st.st_size;
+        num_entries++;
+    }
+
+    qsort(entries, num_entries, sizeof(struct cache_entry), compare_cache_entries);
+    off_t bytes = 0;
+    for (size_t i = 0; i < num_entries; i++) {
+        bytes += entries[i].size;
+        if (i >= MAX_CACHE_ENTRIES || bytes > MAX_CACHE_BYTES) {
+            DEBUG("Evicting cache entry %s/%s\n", dir, entries[i].name);
+            unlinkat(dir_fd, entries[i].name, 0);
+        }
+    }
+
+    free(entries);
+    closedir(d);
+}
+
+/* An image waiting to be written to the cache. */
+struct pending_entry {
+    uint64_t key;
+    cairo_surface_t *img;
+    int full_size[2];
+};
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Only the most recently stored image is written. */
+static struct pending_entry *pending = NULL;
+static bool writing_allowed = false;
+static bool writer_running = false;
+
+static void free_pending_entry(struct pending_entry *entry) {
+    if (entry != NULL) {
+        cairo_surface_destroy(entry->img);
+        free(entry);
+    }
+}
+
+/*
+ * Writes the cache entry. Runs in the cache writer thread, so it must not
+ * touch anything but the entry.
+ *
+ */
+static void write_cache_entry(const struct pending_entry *entry) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 32];
+    if (!cache_dir(dir, sizeof(dir)) || !cache_entry_path(entry->key, path, sizeof(path))) {
+        return;
+    }
+
+    cairo_surface_t *img = entry->img;
+    const cairo_format_t format = cairo_image_surface_get_format(img);
+    const int width = cairo_image_surface_get_width(img);
+    const int height = cairo_image_surface_get_height(img);
+    const int stride = cairo_image_surface_get_stride(img);
+
+    /* Create $XDG_CACHE_HOME (if needed) and our directory within it. */
+    char *slash = strrchr(dir, '/');
+    *slash = '\0';
+    mkdir(dir, 0700);
+    *slash = '/';
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        DEBUG("Could not create cache directory %s: %s\n", dir, strerror(errno));
+        return;
+    }
+
+    /* Write to a temporary file first, so that other instances never map a
+     * partially written entry. */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        DEBUG("Could not create cache entry %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    struct cache_trailer trailer = {
+        .key = entry->key,
+        .format = format,
+        .width = width,
+        .height = height,
+        .full_width = entry->full_size[0],
+        .full_height = entry->full_size[1],
+    };
+    memcpy(trailer.magic, CACHE_MAGIC, sizeof(trailer.magic));
+
+    const unsigned char *data = cairo_image_surface_get_data(img);
+    const size_t size = (size_t)stride * height;
+    bool success = true;
+    for (size_t written = 0; success && written < size;) {
+        const ssize_t n = write(fd, data + written, size - written);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        success = (n > 0);
+        written += (n > 0 ? n : 0);
+    }
+    success = success && write(fd, &trailer, sizeof(trailer)) == sizeof(trailer);
+    success = (close(fd) == 0) && success;
+
+    if (!success || rename(tmp_path, path) != 0) {
+        DEBUG("Could not write cache entry %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return;
+    }
+    DEBUG("Stored decoded image in cache entry %s\n", path);
+
+    evict_cache_entries(dir);
+}
+
+static void *cache_writer(void *arg) {
+    pthread_mutex_lock(&pending_lock);
+    while (pending != NULL) {
+        struct pending_entry *entry = pending;
+        pending = NULL;
+        pthread_mutex_unlock(&pending_lock);
+
+        write_cache_entry(entry);
+        free_pending_entry(entry);
+
+        pthread_mutex_lock(&pending_lock);
+    }
+    writer_running = false;
+    pthread_mutex_unlock(&pending_lock);
+    return NULL;
+}
+
+/*
+ * Starts the cache writer thread if there is something to write and it is not
+ * running yet. Must be called with pending_lock held.
+ *
+ */
+static void start_cache_writer(void) {
+    if (!writing_allowed || writer_running || pending == NULL) {
+        return;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, cache_writer, NULL) != 0) {
+        DEBUG("Could not start the cache writer thread\n");
+        return;
+    }
+    pthread_detach(thread);
+    writer_running = true;
+}
+
+void store_cached_image(const char *image_path, const char *geometry, cairo_surface_t *img, const int full_size[2]) {
+    uint64_t key;
+    if (cairo_surface_get_type(img) != CAIRO_SURFACE_TYPE_IMAGE ||
+        !cache_key(image_path, geometry, &key)) {
+        return;
+    }
+
+    const cairo_format_t format = cairo_image_surface_get_format(img);
+    const int width = cairo_image_surface_get_width(img);
+    const int height = cairo_image_surface_get_height(img);
+    if ((format != CAIRO_FORMAT_RGB24 && format != CAIRO_FORMAT_ARGB32) || width <= 0 ||
+        cairo_image_surface_get_stride(img) != width * 4 ||
+        (size_t)width * height * 4 + sizeof(struct cache_trailer) > MAX_CACHE_BYTES) {
+        return;
+    }
+
+    struct pending_entry *entry = malloc(sizeof(struct pending_entry));
+    if (entry == NULL) {
+        return;
+    }
+    /* The pixels are only read from now on, by the writer thread as well as
+     * for drawing, so the surface can be shared. */
+    cairo_surface_flush(img);
+    entry->key = key;
+    entry->img = cairo_surface_reference(img);
+    entry->full_size[0] = full_size[0];
+    entry->full_size[1] = full_size[1];
+
+    pthread_mutex_lock(&pending_lock);
+    free_pending_entry(pending);
+    pending = entry;
+    start_cache_writer();
+    pthread_mutex_unlock(&pending_lock);
+}
+
+void start_storing_cached_images(void) {
+    pthread_mutex_lock(&pending_lock);
+    writing_allowed = true;
+    start_cache_writer();
+    pthread_mutex_unlock(&pending_lock);
+}
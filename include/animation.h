@@ -0,0 +1,27 @@
+#ifndef _ANIMATION_H
+#define _ANIMATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <ev.h>
+#include <cairo.h>
+
+/*
+ * Reads the list of frames (all files in dir, in alphabetical order) and
+ * loads the first one, which is returned. The other frames are loaded by
+ * animation_start(). image_raw_format and min_size are passed to
+ * load_image(). Returns NULL on error.
+ *
+ */
+cairo_surface_t *animation_init(const char *dir, const char *image_raw_format,
+                                const uint32_t min_size[2], int fps);
+
+/*
+ * Starts the thread which loads the frames ahead of time and the timer which
+ * displays them. Threads do not survive fork(), so this must be called after
+ * i3lock forked into the background. Does nothing for a single frame.
+ *
+ */
+void animation_start(struct ev_loop *loop);
+
+#endif
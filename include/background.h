@@ -0,0 +1,66 @@
+#ifndef _BACKGROUND_H
+#define _BACKGROUND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+
+#include "randr.h"
+
+typedef enum {
+    SCALING_NONE = 0, /* paint the image once at (0, 0) of the root window */
+    SCALING_CENTER,   /* center the unscaled image on each monitor */
+    SCALING_FILL,     /* cover each monitor, cropping the image */
+    SCALING_FIT,      /* show the whole image on each monitor */
+    SCALING_STRETCH,  /* cover each monitor, ignoring the aspect ratio */
+} scaling_mode_t;
+
+/*
+ * Parses the argument of --scaling. Returns false for unknown modes.
+ *
+ */
+bool parse_scaling_mode(const char *name, scaling_mode_t *mode);
+
+/* The image scaled for each monitor of a layout. */
+struct scaled_images;
+
+/*
+ * Stores the current monitors in monitors (at most max) and returns their
+ * number. Without any RandR/Xinerama screens, the root window is the monitor.
+ *
+ */
+int get_monitors(Rect *monitors, int max);
+
+/*
+ * Scales image for each of the given monitors according to scaling_mode.
+ * Unlike the other functions, this can be called from any thread. Returns
+ * NULL on error.
+ *
+ */
+struct scaled_images *scale_image(cairo_surface_t *image, const Rect *monitors, int num_monitors);
+
+void free_scaled_images(struct scaled_images *images);
+
+/*
+ * Uses images (as returned by scale_image() for the new img) instead of
+ * computing them when drawing the next time. Takes ownership of images.
+ *
+ */
+void use_scaled_images(struct scaled_images *images);
+
+/*
+ * Discards the images scaled for each monitor. Must be called whenever img
+ * is replaced.
+ *
+ */
+void invalidate_scaled_images(void);
+
+/*
+ * Paints img onto each monitor according to scaling_mode. The scaled images
+ * are only computed when the monitor layout (or the image) changed.
+ *
+ */
+void draw_scaled_images(cairo_t *ctx);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+/*
+ * Draws frames times each unlock indicator state (and the background alone)
+ * onto an offscreen pixmap and prints how long that took (--benchmark). The
+ * lock window is neither mapped nor are keyboard and pointer grabbed.
+ *
+ */
+void run_benchmark(int frames);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _DISPLAY_H
+#define _DISPLAY_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+#include <xcb/screensaver.h>
+#include <ev.h>
+
+/*
+ * Subscribes to MIT-SCREEN-SAVER events on the root window and queries the
+ * current screen saver and DPMS state. The first screen saver event code is
+ * stored in event_base, if the extension is present.
+ *
+ */
+void display_init(int *event_base, xcb_window_t root);
+
+/*
+ * Starts checking the DPMS state, which the X server does not send events
+ * for: once the DPMS timeouts say the display should be off, and every second
+ * while it is. Turning the display off explicitly (xset dpms force off) is
+ * only noticed at the next of these checks.
+ *
+ */
+void display_start(struct ev_loop *loop);
+
+/*
+ * Called on every key press. Input turns the display on again, so this marks
+ * it as on and restarts the DPMS timeout, without asking the X server. It
+ * does not redraw: the key press usually does, otherwise the caller has to
+ * (see display_redraw_pending()).
+ *
+ */
+void display_input(void);
+
+void display_handle_screensaver_notify(xcb_screensaver_notify_event_t *event);
+
+/*
+ * Returns whether the screen saver blanked the screen or DPMS turned off the
+ * display, i.e. nothing we draw is visible.
+ *
+ */
+bool display_powered_off(void);
+
+/*
+ * Called by redraw_screen() before composing a frame. Returns true (and
+ * counts the frame as skipped) while the display is off. One up-to-date frame
+ * is drawn once the display is on again.
+ *
+ */
+bool display_skip_redraw(void);
+
+/*
+ * Returns whether a redraw was skipped while the display was off and no frame
+ * was drawn since, i.e. the screen shows an outdated frame.
+ *
+ */
+bool display_redraw_pending(void);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _EFFECTS_H
+#define _EFFECTS_H
+
+#include <cairo.h>
+
+/*
+ * Blurs the image surface img in place with three passes of a box blur of the
+ * given radius (in pixels), which approximates a gaussian blur.
+ *
+ */
+void blur_image(cairo_surface_t *img, int radius);
+
+/*
+ * Replaces each block of size x size pixels of the image surface img with its
+ * average color.
+ *
+ */
+void pixelate_image(cairo_surface_t *img, int size);
+
+#endif
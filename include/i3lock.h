@@ -12,4 +12,17 @@
         }                                                          \
     } while (0)
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+long current_rss_kib(void);
+
+struct dirent;
+
+/*
+ * scandir() filter which skips hidden files (and . and ..).
+ *
+ */
+int skip_hidden_files(const struct dirent *ent);
+
 #endif
@@ -0,0 +1,45 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+
+cairo_surface_t *load_image(const char *image_path, const char *image_raw_format, const uint32_t min_size[2]);
+cairo_surface_t *load_image_fd(int fd, const char *image_raw_format);
+cairo_surface_t *capture_screen(void);
+cairo_surface_t *crop_image(cairo_surface_t *img, int width, int height);
+
+/*
+ * Stores the size of an image returned by load_image() or load_image_fd() in
+ * width and height. Returns false if the size is unknown.
+ *
+ */
+bool image_size(cairo_surface_t *img, int *width, int *height);
+
+/*
+ * Returns the decoded image stored by store_cached_image() for the current
+ * version of the file at image_path and the given geometry (any string
+ * describing how the image was processed after decoding), or NULL. The size
+ * of the image before processing is stored in full_size.
+ *
+ */
+cairo_surface_t *load_cached_image(const char *image_path, const char *geometry, int full_size[2]);
+
+/*
+ * Stores img (an image surface) in the cache, see load_cached_image(). The
+ * entry is written by a thread, which only starts once
+ * start_storing_cached_images() was called, so that writing does not delay
+ * locking the screen. img must not be modified afterwards.
+ *
+ */
+void store_cached_image(const char *image_path, const char *geometry, cairo_surface_t *img, const int full_size[2]);
+
+/*
+ * Starts writing the images passed to store_cached_image(). Threads must only
+ * be started after forking, so this is called once the screen is locked.
+ *
+ */
+void start_storing_cached_images(void);
+
+#endif
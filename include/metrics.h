@@ -0,0 +1,66 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <time.h>
+#include <ev.h>
+
+typedef enum {
+    METRIC_FRAMES_RENDERED = 0,
+    METRIC_FRAMES_SKIPPED, /* while the display was off */
+    METRIC_KEYMAP_LOADS,
+    METRIC_RANDR_CHANGES,
+    METRIC_FAILED_ATTEMPTS,
+    METRIC_STALLS, /* see --stall-threshold */
+    NUM_COUNTERS
+} metric_counter_t;
+
+typedef enum {
+    METRIC_TIME_TO_LOCK = 0, /* until the window was mapped */
+    METRIC_TIME_TO_GRAB,
+    METRIC_UNLOCK_TO_DESKTOP, /* from successful authentication to exit */
+    NUM_GAUGES
+} metric_gauge_t;
+
+typedef enum {
+    METRIC_AUTH_SECONDS = 0,
+    METRIC_REDRAW_SECONDS,
+    NUM_HISTOGRAMS
+} metric_histogram_t;
+
+void metrics_count(metric_counter_t counter);
+
+/*
+ * Sets the gauge to the number of seconds since start (CLOCK_MONOTONIC).
+ * Gauges which were never set are not written.
+ *
+ */
+void metrics_set_since(metric_gauge_t gauge, const struct timespec *start);
+
+/*
+ * Adds the number of seconds since start (CLOCK_MONOTONIC) to the histogram.
+ *
+ */
+void metrics_observe_since(metric_histogram_t histogram, const struct timespec *start);
+
+/*
+ * Enables writing the metrics to path (--metrics-file) in the Prometheus text
+ * format, e.g. for the node_exporter textfile collector. Metrics are collected
+ * regardless, this only decides whether they are written.
+ *
+ */
+void metrics_open(const char *path);
+
+/*
+ * Starts writing the metrics every minute.
+ *
+ */
+void metrics_start(struct ev_loop *loop);
+
+/*
+ * Writes the metrics now. The file is replaced atomically, so readers never
+ * see a partially written file.
+ *
+ */
+void metrics_write(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stddef.h>
+
+typedef void (*parallel_fn_t)(size_t i, void *arg);
+
+/*
+ * Returns the number of threads parallel_for() uses at most.
+ *
+ */
+int parallel_threads(void);
+
+/*
+ * Calls fn(i, arg) for each i in [0, n), distributed across all CPUs. Returns
+ * once all calls have returned.
+ *
+ */
+void parallel_for(size_t n, parallel_fn_t fn, void *arg);
+
+#endif
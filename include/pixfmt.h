@@ -0,0 +1,67 @@
+#ifndef _PIXFMT_H
+#define _PIXFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Converts one row of width raw pixels at src into cairo’s RGB24 format,
+ * i.e. 32-bit integers in native endianness with the upper 8 bits unused. */
+typedef void (*pixfmt_convert_t)(uint32_t *dest, const unsigned char *src, size_t width);
+
+typedef enum {
+    PIXFMT_IMPL_SCALAR = 0, /* portable C, specialized per format at compile-time */
+    PIXFMT_IMPL_SSSE3 = 1,  /* 4 pixels per iteration using pshufb */
+    PIXFMT_IMPL_AVX2 = 2,   /* 8 pixels per iteration using vpshufb */
+    PIXFMT_IMPL_MAX = 3,
+} pixfmt_impl_t;
+
+struct raw_pixel_format {
+    const char *name;
+    /* Bytes per pixel and the offset of each channel within a pixel. */
+    int bpp;
+    int red;
+    int green;
+    int blue;
+    /* One converter per implementation, NULL if not compiled in. */
+    pixfmt_convert_t convert[PIXFMT_IMPL_MAX];
+};
+
+extern const struct raw_pixel_format raw_fmt_rgb;
+extern const struct raw_pixel_format raw_fmt_rgbx;
+extern const struct raw_pixel_format raw_fmt_xrgb;
+extern const struct raw_pixel_format raw_fmt_bgr;
+extern const struct raw_pixel_format raw_fmt_bgrx;
+extern const struct raw_pixel_format raw_fmt_xbgr;
+
+/*
+ * Returns the pre-defined pixel format with the given name (e.g. "rgb"), or
+ * NULL if there is no such format.
+ *
+ */
+const struct raw_pixel_format *raw_pixel_format_by_name(const char *name);
+
+/*
+ * Reference implementation: converts one row using the channel offsets stored
+ * in fmt, one pixel at a time. All other converters must produce the exact
+ * same output.
+ *
+ */
+void raw_pixel_format_convert_generic(const struct raw_pixel_format *fmt,
+                                      uint32_t *dest, const unsigned char *src, size_t width);
+
+/*
+ * Returns the fastest implementation supported by the CPU we are running on.
+ *
+ */
+pixfmt_impl_t pixfmt_best_impl(void);
+
+const char *pixfmt_impl_name(pixfmt_impl_t impl);
+
+/*
+ * Returns the fastest converter for the given format which is supported by
+ * the CPU we are running on.
+ *
+ */
+pixfmt_convert_t raw_pixel_format_converter(const struct raw_pixel_format *fmt);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+#include <config.h>
+
+/*
+ * Static tracepoints (USDT) for bpftrace, perf and SystemTap, enabled with
+ * meson configure -Dsdt=true. When compiled in, an unused probe is a single
+ * nop. List them with e.g. bpftrace -l 'usdt:/usr/bin/i3lock:*'.
+ *
+ * All probes use the provider "i3lock". Probes ending in _begin and _end come
+ * in pairs, so that latencies can be measured from the difference. Probes
+ * must never pass anything derived from the password, not even keycodes.
+ *
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(i3lock, name)
+#define PROBE1(name, a) DTRACE_PROBE1(i3lock, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(i3lock, name, a, b)
+#else
+#define PROBE(name) \
+    do {            \
+    } while (0)
+#define PROBE1(name, a) \
+    do {                \
+    } while (0)
+#define PROBE2(name, a, b) \
+    do {                   \
+    } while (0)
+#endif
+
+#endif
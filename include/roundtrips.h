@@ -0,0 +1,57 @@
+#ifndef _ROUNDTRIPS_H
+#define _ROUNDTRIPS_H
+
+#include <config.h>
+
+/*
+ * Synchronous X11 round trips which i3lock makes itself (xcb_*_reply(),
+ * xcb_request_check() and xcb_aux_sync(), wrapped with ROUNDTRIP()) are
+ * counted per phase when built with meson configure
+ * -Droundtrip_accounting=true. Round trips within libraries (e.g. cairo-xcb
+ * or xkbcommon-x11) are not counted.
+ *
+ * Handling a key press should not wait for the X server, so i3lock warns when
+ * a key press (not counting authentication) needed a counted round trip.
+ * tests/roundtrip_test.c checks this on Xvfb.
+ *
+ */
+typedef enum {
+    ROUNDTRIP_STARTUP = 0,
+    ROUNDTRIP_IDLE,      /* timers and other events */
+    ROUNDTRIP_KEYSTROKE, /* handle_key_press() */
+    ROUNDTRIP_AUTH,      /* input_done() */
+    ROUNDTRIP_RESIZE,    /* handle_screen_resize() and RandR changes */
+    NUM_ROUNDTRIP_PHASES
+} roundtrip_phase_t;
+
+#ifdef I3LOCK_ROUNDTRIP_ACCOUNTING
+/* Only the main thread's connection is counted. */
+extern roundtrip_phase_t roundtrip_phase;
+extern unsigned int roundtrips[NUM_ROUNDTRIP_PHASES];
+
+/* Wraps a call which blocks until the X server replied, e.g. xcb_*_reply(). */
+#define ROUNDTRIP(reply) (roundtrips[roundtrip_phase]++, (reply))
+
+/*
+ * Counts round trips towards phase until roundtrip_phase_leave() is called
+ * with the returned (previous) phase. Phases can nest.
+ *
+ */
+roundtrip_phase_t roundtrip_phase_enter(roundtrip_phase_t phase);
+void roundtrip_phase_leave(roundtrip_phase_t previous);
+
+/*
+ * Prints the number of round trips per phase to stderr.
+ *
+ */
+void roundtrips_report(void);
+#else
+#define ROUNDTRIP(reply) (reply)
+#define roundtrip_phase_enter(phase) ROUNDTRIP_STARTUP
+#define roundtrip_phase_leave(previous) (void)(previous)
+#define roundtrips_report() \
+    do {                    \
+    } while (0)
+#endif
+
+#endif
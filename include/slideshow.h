@@ -0,0 +1,49 @@
+#ifndef _SLIDESHOW_H
+#define _SLIDESHOW_H
+
+#include <stdbool.h>
+#include <ev.h>
+
+/*
+ * Adds an image (-i) to the slideshow. If path is a directory, all files in
+ * it are added, in alphabetical order. Directories are read by
+ * slideshow_init() and again by slideshow_reread().
+ *
+ */
+void slideshow_add(const char *path);
+
+/*
+ * Reads the list of images and returns (a copy of) the path of the first one,
+ * which the caller loads as usual. The other images are loaded by
+ * slideshow_start(). image_raw_format is passed to load_image(). The images
+ * change every interval seconds. Returns NULL if there are no images.
+ *
+ */
+char *slideshow_init(const char *image_raw_format, double interval);
+
+/*
+ * Starts the thread which loads the next image ahead of time and the timer
+ * which displays it, unless there is only a single image (and no directory).
+ * Threads do not survive fork(), so this must be called after i3lock forked
+ * into the background.
+ *
+ */
+void slideshow_start(struct ev_loop *loop);
+
+/*
+ * Loads the current image again in the background, e.g. because the
+ * resolution changed. Returns false if the slideshow was not started, in
+ * which case the caller needs to load the image again itself.
+ *
+ */
+bool slideshow_reload(void);
+
+/*
+ * Reads the images and directories again (on SIGHUP), staying at the current
+ * image if it still exists. Returns false if the slideshow was not started,
+ * in which case the caller needs to load the single image again itself.
+ *
+ */
+bool slideshow_reread(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*
+ * Starts writing a timeline to path (--trace-file), in the Chrome trace event
+ * format, which Perfetto (ui.perfetto.dev) and chrome://tracing can open.
+ *
+ */
+void trace_open(const char *path);
+
+/*
+ * Begins and ends a span (which may contain other spans) called name. Names
+ * are written as-is, so they must be string literals and never contain user
+ * input, let alone the password.
+ *
+ * Only the main thread traces. Without --trace-file, these do nothing.
+ *
+ */
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+/*
+ * Marks a point in time, e.g. a timer firing.
+ *
+ */
+void trace_instant(const char *name);
+
+/*
+ * Writes out all events. Events are also written every second while tracing.
+ * Must be called before fork(), otherwise the buffered events are written by
+ * both processes.
+ *
+ */
+void trace_flush(void);
+
+/*
+ * Terminates the timeline and closes the file.
+ *
+ */
+void trace_close(void);
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef _UNLOCK_INDICATOR_H
 #define _UNLOCK_INDICATOR_H
 
+#include <stdint.h>
 #include <xcb/xcb.h>
+#include <cairo.h>
 
 typedef enum {
     STATE_STARTED = 0,           /* default state */
@@ -22,7 +24,40 @@ typedef enum {
 } auth_state_t;
 
 void free_bg_pixmap(void);
+
+/*
+ * Discards the background kept on the X server with --low-memory. Must be
+ * called whenever img is replaced.
+ *
+ */
+void invalidate_background(void);
 void draw_image(xcb_pixmap_t bg_pixmap, uint32_t* resolution);
+
+/*
+ * Draws the lock screen (background and unlock indicator) onto ctx, which may
+ * belong to any Cairo surface of the given resolution. draw_image() uses this
+ * to draw onto the pixmap on the X server.
+ *
+ */
+void draw_frame(cairo_t* ctx, uint32_t* resolution);
+
+/*
+ * Counts the size of an image surface which is drawn onto the X server. cairo
+ * uploads an image surface when it is drawn for the first time after it was
+ * changed, so this must be called on exactly those occasions.
+ *
+ */
+void count_upload(cairo_surface_t* image);
+
+/*
+ * Returns how many bytes of image data were uploaded to the X server for
+ * drawing so far (--benchmark). Pixmaps created from shared memory
+ * (create_pixmap_from_shm_fd()) do not pass through the X11 socket and are
+ * not counted.
+ *
+ */
+uint64_t get_uploaded_bytes(void);
+
 void redraw_screen(void);
 void clear_indicator(void);
 
@@ -0,0 +1,34 @@
+#ifndef _WATCHDOG_H
+#define _WATCHDOG_H
+
+#include <ev.h>
+#include <xcb/xcb.h>
+
+/*
+ * Times each event loop iteration, from waking up until blocking again, and
+ * logs iterations which took longer than threshold seconds (--stall-threshold)
+ * together with the handler which took the most time and the number of X11
+ * events waiting on conn when a handler exceeding the threshold returned. A
+ * threshold of 0 disables the watchdog.
+ *
+ */
+void watchdog_start(struct ev_loop *loop, xcb_connection_t *conn, double threshold);
+
+/*
+ * Marks the beginning and end of a handler (e.g. "redraw_screen"), which
+ * stalls are attributed to. Handlers can nest, the time spent in nested
+ * handlers is attributed to those. handler must be a string literal.
+ *
+ */
+void watchdog_enter(const char *handler);
+void watchdog_leave(void);
+
+/*
+ * Like xcb_poll_for_event(), but first returns the events the watchdog took
+ * out of xcb's queue to count them. Events of conn must only be read with
+ * this.
+ *
+ */
+xcb_generic_event_t *watchdog_poll_for_event(xcb_connection_t *conn);
+
+#endif
@@ -8,6 +8,9 @@ extern xcb_screen_t *screen;
 
 xcb_visualtype_t *get_root_visual_type(xcb_screen_t *s);
 xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, char *color);
+xcb_pixmap_t create_pixmap_from_shm_fd(xcb_connection_t *conn, xcb_screen_t *scr, int fd, uint16_t width, uint16_t height);
+bool get_root_image(xcb_connection_t *conn, xcb_screen_t *scr, int shm_fd, uint32_t *dest, uint16_t width, uint16_t height);
+bool display_is_off(xcb_connection_t *conn);
 xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, char *color, xcb_pixmap_t pixmap);
 bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor, int tries);
 xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_window_t win, int choice);
@@ -0,0 +1,179 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * metrics.c: collects latencies and counters of the lock session and writes
+ *            them in the Prometheus text format (--metrics-file).
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <ev.h>
+
+#include "i3lock.h"
+#include "metrics.h"
+
+extern bool debug_mode;
+
+/* How often to write the metrics while the screen is locked (in seconds). */
+#define METRICS_INTERVAL 60.0
+
+#define MAX_BUCKETS 10
+
+struct metric {
+    const char *name;
+    const char *help;
+};
+
+static const struct metric counter_info[NUM_COUNTERS] = {
+    [METRIC_FRAMES_RENDERED] = {"i3lock_frames_rendered_total", "Frames drawn and shown on the X server."},
+    [METRIC_FRAMES_SKIPPED] = {"i3lock_frames_skipped_total", "Frames not drawn because the display was off."},
+    [METRIC_KEYMAP_LOADS] = {"i3lock_keymap_loads_total", "XKB keymaps loaded, including the ones at startup."},
+    [METRIC_RANDR_CHANGES] = {"i3lock_randr_changes_total", "RandR screen change notifications."},
+    [METRIC_FAILED_ATTEMPTS] = {"i3lock_failed_attempts_total", "Failed authentication attempts."},
+    [METRIC_STALLS] = {"i3lock_stalls_total", "Event loop iterations which took longer than the stall threshold."},
+};
+
+static const struct metric gauge_info[NUM_GAUGES] = {
+    [METRIC_TIME_TO_LOCK] = {"i3lock_time_to_lock_seconds", "Time from start until the lock window was mapped."},
+    [METRIC_TIME_TO_GRAB] = {"i3lock_time_to_grab_seconds", "Time from start until keyboard and pointer were grabbed."},
+    [METRIC_UNLOCK_TO_DESKTOP] = {"i3lock_unlock_to_desktop_seconds", "Time from successful authentication until i3lock released the screen."},
+};
+
+static const struct metric histogram_info[NUM_HISTOGRAMS] = {
+    [METRIC_AUTH_SECONDS] = {"i3lock_auth_duration_seconds", "Time spent in PAM authentication."},
+    [METRIC_REDRAW_SECONDS] = {"i3lock_redraw_duration_seconds", "Time spent drawing a frame."},
+};
+
+/* Upper bounds of the histogram buckets, the +Inf bucket is implicit. */
+static const double histogram_buckets[NUM_HISTOGRAMS][MAX_BUCKETS] = {
+    [METRIC_AUTH_SECONDS] = {0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10},
+    [METRIC_REDRAW_SECONDS] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25},
+};
+
+static uint64_t counters[NUM_COUNTERS];
+
+static double gauges[NUM_GAUGES];
+static bool gauge_set[NUM_GAUGES];
+
+struct histogram {
+    /* Observations per bucket, not cumulative. */
+    uint64_t buckets[MAX_BUCKETS];
+    uint64_t count;
+    double sum;
+};
+static struct histogram histograms[NUM_HISTOGRAMS];
+
+static char *metrics_path = NULL;
+static ev_timer write_timer;
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void metrics_count(metric_counter_t counter) {
+    counters[counter]++;
+}
+
+void metrics_set_since(metric_gauge_t gauge, const struct timespec *start) {
+    gauges[gauge] = seconds_since(start);
+    gauge_set[gauge] = true;
+}
+
+void metrics_observe_since(metric_histogram_t histogram, const struct timespec *start) {
+    const double value = seconds_since(start);
+    struct histogram *h = &histograms[histogram];
+    const double *bounds = histogram_buckets[histogram];
+    /* Unused buckets are 0, and bounds are ascending otherwise. */
+    for (int i = 0; i < MAX_BUCKETS && bounds[i] > 0; i++) {
+        if (value <= bounds[i]) {
+            h->buckets[i]++;
+            break;
+        }
+    }
+    h->count++;
+    h->sum += value;
+}
+
+static void write_metrics(FILE *f) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n",
+                counter_info[i].name, counter_info[i].help,
+                counter_info[i].name, counter_info[i].name, counters[i]);
+    }
+
+    for (int i = 0; i < NUM_GAUGES; i++) {
+        if (!gauge_set[i]) {
+            continue;
+        }
+        fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n%s %.6f\n",
+                gauge_info[i].name, gauge_info[i].help,
+                gauge_info[i].name, gauge_info[i].name, gauges[i]);
+    }
+
+    for (int i = 0; i < NUM_HISTOGRAMS; i++) {
+        const char *name = histogram_info[i].name;
+        const struct histogram *h = &histograms[i];
+        fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_info[i].help, name);
+        uint64_t cumulative = 0;
+        for (int b = 0; b < MAX_BUCKETS && histogram_buckets[i][b] > 0; b++) {
+            cumulative += h->buckets[b];
+            fprintf(f, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, histogram_buckets[i][b], cumulative);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, h->count);
+        fprintf(f, "%s_sum %.6f\n%s_count %" PRIu64 "\n", name, h->sum, name, h->count);
+    }
+}
+
+void metrics_write(void) {
+    if (metrics_path == NULL) {
+        return;
+    }
+
+    /* Write to a temporary file first, so that the collector never reads a
+     * partially written file. */
+    char *tmp_path;
+    if (asprintf(&tmp_path, "%s.%d.tmp", metrics_path, (int)getpid()) == -1) {
+        return;
+    }
+    FILE *f = fopen(tmp_path, "we");
+    if (f == NULL) {
+        DEBUG("Could not create %s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return;
+    }
+    write_metrics(f);
+    const bool success = !ferror(f);
+    if (fclose(f) != 0 || !success || rename(tmp_path, metrics_path) != 0) {
+        DEBUG("Could not write metrics to %s: %s\n", metrics_path, strerror(errno));
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+static void write_metrics_cb(EV_P_ ev_timer *w, int revents) {
+    metrics_write();
+}
+
+void metrics_open(const char *path) {
+    metrics_path = strdup(path);
+}
+
+void metrics_start(struct ev_loop *loop) {
+    if (metrics_path == NULL) {
+        return;
+    }
+    metrics_write();
+    ev_timer_init(&write_timer, write_metrics_cb, METRICS_INTERVAL, METRICS_INTERVAL);
+    ev_timer_start(loop, &write_timer);
+}
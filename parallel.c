@@ -0,0 +1,74 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * parallel.c: runs independent pieces of work (e.g. one per monitor) on all
+ *             CPUs. Threads only live for the duration of one parallel_for()
+ *             call, so that no threads are around when i3lock forks.
+ *
+ */
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+#define MAX_THREADS 32
+
+struct parallel_job {
+    parallel_fn_t fn;
+    void *arg;
+    size_t n;
+    atomic_size_t next;
+};
+
+static void *parallel_worker(void *data) {
+    struct parallel_job *job = data;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n) {
+        job->fn(i, job->arg);
+    }
+    return NULL;
+}
+
+int parallel_threads(void) {
+    static long threads = 0;
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) {
+            threads = 1;
+        } else if (threads > MAX_THREADS) {
+            threads = MAX_THREADS;
+        }
+    }
+    return threads;
+}
+
+void parallel_for(size_t n, parallel_fn_t fn, void *arg) {
+    struct parallel_job job = {
+        .fn = fn,
+        .arg = arg,
+        .n = n,
+    };
+    atomic_init(&job.next, 0);
+
+    /* The calling thread works, too, so start one thread less. */
+    pthread_t threads[MAX_THREADS];
+    size_t wanted = (n < (size_t)parallel_threads() ? n : (size_t)parallel_threads());
+    size_t started = 0;
+    for (; started + 1 < wanted; started++) {
+        /* If a thread cannot be started, the remaining work is just done
+         * by fewer threads. */
+        if (pthread_create(&threads[started], NULL, parallel_worker, &job) != 0) {
+            break;
+        }
+    }
+
+    parallel_worker(&job);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
@@ -0,0 +1,186 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * pixfmt.c: converts rows of raw pixels (--raw) into cairo’s native-endian
+ *           RGB24 format. Each pre-defined pixel format gets its own
+ *           converters with the channel offsets known at compile-time, and
+ *           SIMD variants are selected at run-time depending on the CPU.
+ *
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pixfmt.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PIXFMT_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Converts width pixels with the given layout. Always inlined into the
+ * per-format wrappers below, so that the offsets are constants and the
+ * compiler can unroll and vectorize as it sees fit.
+ *
+ */
+static inline __attribute__((always_inline)) void convert_scalar(
+    uint32_t *dest, const unsigned char *src, size_t width,
+    const int bpp, const int red, const int green, const int blue) {
+    for (size_t x = 0; x < width; x++, src += bpp) {
+        dest[x] = (uint32_t)src[red] << 16 |
+                  (uint32_t)src[green] << 8 |
+                  (uint32_t)src[blue];
+    }
+}
+
+#ifdef PIXFMT_X86
+/* The pshufb control bytes for 4 consecutive pixels: in each 32-bit output
+ * word, the lowest byte is blue, then green, then red. A control byte with
+ * its highest bit set (-128) zeroes the unused upper byte. */
+#define SHUFFLE_MASK(bpp, red, green, blue)                            \
+    0 * (bpp) + (blue), 0 * (bpp) + (green), 0 * (bpp) + (red), -128, \
+        1 * (bpp) + (blue), 1 * (bpp) + (green), 1 * (bpp) + (red), -128, \
+        2 * (bpp) + (blue), 2 * (bpp) + (green), 2 * (bpp) + (red), -128, \
+        3 * (bpp) + (blue), 3 * (bpp) + (green), 3 * (bpp) + (red), -128
+
+static inline __attribute__((always_inline, target("ssse3"))) void convert_ssse3(
+    uint32_t *dest, const unsigned char *src, size_t width,
+    const int bpp, const int red, const int green, const int blue) {
+    const __m128i mask = _mm_setr_epi8(SHUFFLE_MASK(bpp, red, green, blue));
+    size_t x = 0;
+    /* Every iteration loads 16 bytes but only consumes 4 * bpp of them, so
+     * stop while there are still 16 bytes left to not read past the row. */
+    for (; (width - x) * bpp >= 16; x += 4) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + x * bpp));
+        _mm_storeu_si128((__m128i *)(dest + x), _mm_shuffle_epi8(in, mask));
+    }
+    convert_scalar(dest + x, src + x * bpp, width - x, bpp, red, green, blue);
+}
+
+static inline __attribute__((always_inline, target("avx2"))) void convert_avx2(
+    uint32_t *dest, const unsigned char *src, size_t width,
+    const int bpp, const int red, const int green, const int blue) {
+    /* vpshufb cannot move bytes across the two 128-bit lanes. For 3 byte
+     * pixels, the second group of 4 pixels starts at byte 12, so we first
+     * move dwords 3 to 6 into the upper lane. */
+    const __m256i lanes = (bpp == 3 ? _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6)
+                                    : _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i mask = _mm256_setr_epi8(SHUFFLE_MASK(bpp, red, green, blue),
+                                          SHUFFLE_MASK(bpp, red, green, blue));
+    size_t x = 0;
+    for (; (width - x) * bpp >= 32; x += 8) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(src + x * bpp));
+        if (bpp == 3) {
+            in = _mm256_permutevar8x32_epi32(in, lanes);
+        }
+        _mm256_storeu_si256((__m256i *)(dest + x), _mm256_shuffle_epi8(in, mask));
+    }
+    convert_ssse3(dest + x, src + x * bpp, width - x, bpp, red, green, blue);
+}
+
+#undef SHUFFLE_MASK
+
+#define DEFINE_SIMD_CONVERTERS(name, bpp, red, green, blue)                                                                 \
+    static __attribute__((target("ssse3"))) void convert_##name##_ssse3(uint32_t *dest, const unsigned char *src, size_t width) { \
+        convert_ssse3(dest, src, width, bpp, red, green, blue);                                                              \
+    }                                                                                                                        \
+    static __attribute__((target("avx2"))) void convert_##name##_avx2(uint32_t *dest, const unsigned char *src, size_t width) {   \
+        convert_avx2(dest, src, width, bpp, red, green, blue);                                                               \
+    }
+#define SIMD_CONVERTERS(name) convert_##name##_ssse3, convert_##name##_avx2
+#else
+#define DEFINE_SIMD_CONVERTERS(name, bpp, red, green, blue)
+#define SIMD_CONVERTERS(name) NULL, NULL
+#endif
+
+/* Pre-defined pixel formats (<bytes per pixel>, <red>, <green>, <blue>) */
+#define RAW_PIXEL_FORMAT(name, bpp, red, green, blue)                                                  \
+    static void convert_##name##_scalar(uint32_t *dest, const unsigned char *src, size_t width) { \
+        convert_scalar(dest, src, width, bpp, red, green, blue);                                   \
+    }                                                                                              \
+    DEFINE_SIMD_CONVERTERS(name, bpp, red, green, blue)                                            \
+    const struct raw_pixel_format raw_fmt_##name = {                                              \
+        #name, bpp, red, green, blue, {convert_##name##_scalar, SIMD_CONVERTERS(name)}};
+
+RAW_PIXEL_FORMAT(rgb, 3, 0, 1, 2)
+RAW_PIXEL_FORMAT(rgbx, 4, 0, 1, 2)
+RAW_PIXEL_FORMAT(xrgb, 4, 1, 2, 3)
+RAW_PIXEL_FORMAT(bgr, 3, 2, 1, 0)
+RAW_PIXEL_FORMAT(bgrx, 4, 2, 1, 0)
+RAW_PIXEL_FORMAT(xbgr, 4, 3, 2, 1)
+
+#undef RAW_PIXEL_FORMAT
+#undef DEFINE_SIMD_CONVERTERS
+#undef SIMD_CONVERTERS
+
+static const struct raw_pixel_format *raw_pixel_formats[] = {
+    &raw_fmt_rgb,
+    &raw_fmt_rgbx,
+    &raw_fmt_xrgb,
+    &raw_fmt_bgr,
+    &raw_fmt_bgrx,
+    &raw_fmt_xbgr,
+};
+
+const struct raw_pixel_format *raw_pixel_format_by_name(const char *name) {
+    for (size_t i = 0; i < sizeof(raw_pixel_formats) / sizeof(raw_pixel_formats[0]); i++) {
+        if (strcmp(raw_pixel_formats[i]->name, name) == 0) {
+            return raw_pixel_formats[i];
+        }
+    }
+    return NULL;
+}
+
+void raw_pixel_format_convert_generic(const struct raw_pixel_format *fmt,
+                                      uint32_t *dest, const unsigned char *src, size_t width) {
+    for (size_t x = 0; x < width; ++x) {
+        size_t idx = x * fmt->bpp;
+        dest[x] = 0 |
+                  (uint32_t)(src[idx + fmt->red]) << 16 |
+                  (uint32_t)(src[idx + fmt->green]) << 8 |
+                  (uint32_t)(src[idx + fmt->blue]);
+    }
+}
+
+pixfmt_impl_t pixfmt_best_impl(void) {
+#ifdef PIXFMT_X86
+    static bool initialized = false;
+    static pixfmt_impl_t best = PIXFMT_IMPL_SCALAR;
+    if (!initialized) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            best = PIXFMT_IMPL_AVX2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            best = PIXFMT_IMPL_SSSE3;
+        }
+        initialized = true;
+    }
+    return best;
+#else
+    return PIXFMT_IMPL_SCALAR;
+#endif
+}
+
+const char *pixfmt_impl_name(pixfmt_impl_t impl) {
+    switch (impl) {
+        case PIXFMT_IMPL_SSSE3:
+            return "ssse3";
+        case PIXFMT_IMPL_AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+pixfmt_convert_t raw_pixel_format_converter(const struct raw_pixel_format *fmt) {
+    for (int impl = pixfmt_best_impl(); impl > PIXFMT_IMPL_SCALAR; impl--) {
+        if (fmt->convert[impl] != NULL) {
+            return fmt->convert[impl];
+        }
+    }
+    return fmt->convert[PIXFMT_IMPL_SCALAR];
+}
@@ -17,6 +17,9 @@
 #include "i3lock.h"
 #include "xcb.h"
 #include "randr.h"
+#include "probes.h"
+#include "trace.h"
+#include "roundtrips.h"
 
 /* Number of Xinerama screens which are currently present. */
 int xr_screens = 0;
@@ -43,8 +46,8 @@ void randr_init(int *event_base, xcb_window_t root) {
 
     xcb_generic_error_t *err;
     xcb_randr_query_version_reply_t *randr_version =
-        xcb_randr_query_version_reply(
-            conn, xcb_randr_query_version(conn, XCB_RANDR_MAJOR_VERSION, XCB_RANDR_MINOR_VERSION), &err);
+        ROUNDTRIP(xcb_randr_query_version_reply(
+            conn, xcb_randr_query_version(conn, XCB_RANDR_MAJOR_VERSION, XCB_RANDR_MINOR_VERSION), &err));
     if (err != NULL) {
         DEBUG("Could not query RandR version: X11 error code %d\n", err->error_code);
         _xinerama_init();
@@ -81,7 +84,7 @@ void _xinerama_init(void) {
     xcb_xinerama_is_active_reply_t *reply;
 
     cookie = xcb_xinerama_is_active(conn);
-    reply = xcb_xinerama_is_active_reply(conn, cookie, NULL);
+    reply = ROUNDTRIP(xcb_xinerama_is_active_reply(conn, cookie, NULL));
     if (!reply) {
         return;
     }
@@ -111,8 +114,8 @@ static bool _randr_query_monitors_15(xcb_window_t root) {
     DEBUG("Querying monitors using RandR 1.5\n");
     xcb_generic_error_t *err;
     xcb_randr_get_monitors_reply_t *monitors =
-        xcb_randr_get_monitors_reply(
-            conn, xcb_randr_get_monitors(conn, root, true), &err);
+        ROUNDTRIP(xcb_randr_get_monitors_reply(
+            conn, xcb_randr_get_monitors(conn, root, true), &err));
     if (err != NULL) {
         DEBUG("Could not get RandR monitors: X11 error code %d\n", err->error_code);
         free(err);
@@ -170,7 +173,7 @@ static bool _randr_query_outputs_14(xcb_window_t root) {
     rcookie = xcb_randr_get_screen_resources_current(conn, root);
 
     xcb_randr_get_screen_resources_current_reply_t *res =
-        xcb_randr_get_screen_resources_current_reply(conn, rcookie, NULL);
+        ROUNDTRIP(xcb_randr_get_screen_resources_current_reply(conn, rcookie, NULL));
     if (res == NULL) {
         DEBUG("Could not query screen resources.\n");
         return false;
@@ -203,7 +206,7 @@ static bool _randr_query_outputs_14(xcb_window_t root) {
     for (int i = 0; i < len; i++) {
         xcb_randr_get_output_info_reply_t *output;
 
-        if ((output = xcb_randr_get_output_info_reply(conn, ocookie[i], NULL)) == NULL) {
+        if ((output = ROUNDTRIP(xcb_randr_get_output_info_reply(conn, ocookie[i], NULL))) == NULL) {
             continue;
         }
 
@@ -215,7 +218,7 @@ static bool _randr_query_outputs_14(xcb_window_t root) {
         xcb_randr_get_crtc_info_cookie_t icookie;
         xcb_randr_get_crtc_info_reply_t *crtc;
         icookie = xcb_randr_get_crtc_info(conn, output->crtc, cts);
-        if ((crtc = xcb_randr_get_crtc_info_reply(conn, icookie, NULL)) == NULL) {
+        if ((crtc = ROUNDTRIP(xcb_randr_get_crtc_info_reply(conn, icookie, NULL))) == NULL) {
             DEBUG("Skipping output: could not get CRTC (0x%08x)\n", output->crtc);
             free(output);
             continue;
@@ -253,7 +256,7 @@ void _xinerama_query_screens(void) {
     xcb_xinerama_screen_info_t *screen_info;
     xcb_generic_error_t *err;
     cookie = xcb_xinerama_query_screens_unchecked(conn);
-    reply = xcb_xinerama_query_screens_reply(conn, cookie, &err);
+    reply = ROUNDTRIP(xcb_xinerama_query_screens_reply(conn, cookie, &err));
     if (!reply) {
         DEBUG("Couldn't get Xinerama screens: X11 error code %d\n", err->error_code);
         free(err);
@@ -286,7 +289,7 @@ void _xinerama_query_screens(void) {
     free(reply);
 }
 
-void randr_query(xcb_window_t root) {
+static void _randr_query(xcb_window_t root) {
     if (_randr_query_monitors_15(root)) {
         return;
     }
@@ -297,3 +300,11 @@ void randr_query(xcb_window_t root) {
 
     _xinerama_query_screens();
 }
+
+void randr_query(xcb_window_t root) {
+    PROBE(randr_query_begin);
+    trace_begin("randr_query");
+    _randr_query(root);
+    trace_end("randr_query");
+    PROBE1(randr_query_end, xr_screens);
+}
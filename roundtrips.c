@@ -0,0 +1,52 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * roundtrips.c: counts synchronous X11 round trips per phase (only built with
+ *               -Droundtrip_accounting=true).
+ *
+ */
+#include <stdio.h>
+
+#include "roundtrips.h"
+
+roundtrip_phase_t roundtrip_phase = ROUNDTRIP_STARTUP;
+unsigned int roundtrips[NUM_ROUNDTRIP_PHASES];
+
+static const char *phase_names[NUM_ROUNDTRIP_PHASES] = {
+    [ROUNDTRIP_STARTUP] = "startup",
+    [ROUNDTRIP_IDLE] = "idle",
+    [ROUNDTRIP_KEYSTROKE] = "keystroke",
+    [ROUNDTRIP_AUTH] = "auth",
+    [ROUNDTRIP_RESIZE] = "resize",
+};
+
+/* Key press round trips before the current key press was handled. */
+static unsigned int keystroke_before;
+
+roundtrip_phase_t roundtrip_phase_enter(roundtrip_phase_t phase) {
+    const roundtrip_phase_t previous = roundtrip_phase;
+    if (phase == ROUNDTRIP_KEYSTROKE) {
+        keystroke_before = roundtrips[ROUNDTRIP_KEYSTROKE];
+    }
+    roundtrip_phase = phase;
+    return previous;
+}
+
+void roundtrip_phase_leave(roundtrip_phase_t previous) {
+    /* Only a warning: aborting would unlock the screen. */
+    if (roundtrip_phase == ROUNDTRIP_KEYSTROKE &&
+        roundtrips[ROUNDTRIP_KEYSTROKE] != keystroke_before) {
+        fprintf(stderr, "[i3lock] BUG: handling a key press needed %u synchronous X11 round trip(s)\n",
+                roundtrips[ROUNDTRIP_KEYSTROKE] - keystroke_before);
+    }
+    roundtrip_phase = previous;
+}
+
+void roundtrips_report(void) {
+    fprintf(stderr, "[i3lock] X11 round trips:");
+    for (int i = 0; i < NUM_ROUNDTRIP_PHASES; i++) {
+        fprintf(stderr, " %s %u%s", phase_names[i], roundtrips[i], (i + 1 < NUM_ROUNDTRIP_PHASES ? "," : "\n"));
+    }
+}
@@ -0,0 +1,457 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * slideshow.c: rotates between several images (-i given more than once, or a
+ *              directory) while locked, and reads them again on SIGHUP. A thread
+ *              loads and scales the next image ahead of time, so the event
+ *              loop only swaps in the finished image when its turn comes.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <xcb/xcb.h>
+#include <ev.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "randr.h"
+#include "image.h"
+#include "background.h"
+#include "unlock_indicator.h"
+#include "slideshow.h"
+#include "trace.h"
+
+extern bool debug_mode;
+
+/* The current resolution of the X11 root window. */
+extern uint32_t last_resolution[2];
+
+/* A Cairo surface containing the specified image (-i), if any. */
+extern cairo_surface_t *img;
+
+/* How the image is placed on each monitor. */
+extern scaling_mode_t scaling_mode;
+
+/* What the loading thread should load, snapshotted on the main thread. */
+struct job {
+    uint64_t generation;
+    int index;
+    char *path;
+    /* With --scaling=fill, fit or stretch: the size the image has to cover.
+     * Otherwise: the size the image is cropped to. */
+    uint32_t resolution[2];
+    bool scaled;
+    int num_monitors;
+    Rect monitors[];
+};
+
+struct slide {
+    uint64_t generation;
+    int index;
+    /* NULL if the image could not be loaded. */
+    cairo_surface_t *surface;
+    struct scaled_images *scaled;
+};
+
+/* The arguments given via -i, and the images they expand to. */
+static char **sources = NULL;
+static int num_sources = 0;
+static char **paths = NULL;
+static int num_paths = 0;
+static char *raw_format = NULL;
+static double interval;
+
+/* State shared with the loading thread, protected by slides_lock. */
+static pthread_mutex_t slides_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slides_cond = PTHREAD_COND_INITIALIZER;
+static struct job *pending = NULL;
+static struct slide *loaded = NULL;
+
+/* State of the main thread. */
+static struct ev_loop *slideshow_loop = NULL;
+static ev_timer slide_timer;
+static ev_async loaded_async;
+/* Incremented whenever the images need to be loaded again, so that slides
+ * which were requested before are discarded. */
+static uint64_t generation = 0;
+static int current = 0;
+static struct slide *next = NULL;
+static bool loading = false;
+/* The timer fired before the next image was loaded. */
+static bool show_when_loaded = false;
+
+void slideshow_add(const char *path) {
+    char **grown = realloc(sources, (num_sources + 1) * sizeof(char *));
+    if (grown == NULL || (grown[num_sources] = strdup(path)) == NULL) {
+        sources = grown;
+        return;
+    }
+    sources = grown;
+    num_sources++;
+}
+
+static void free_paths(char **list, int count) {
+    for (int i = 0; i < count; i++) {
+        free(list[i]);
+    }
+    free(list);
+}
+
+/*
+ * Expands the sources (files or directories) into the list of images.
+ * Returns the number of images.
+ *
+ */
+static int read_paths(char ***result) {
+    char **list = NULL;
+    int count = 0;
+
+    for (int i = 0; i < num_sources; i++) {
+        struct stat st;
+        if (stat(sources[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            char **grown = realloc(list, (count + 1) * sizeof(char *));
+            if (grown != NULL) {
+                list = grown;
+                if ((list[count] = strdup(sources[i])) != NULL) {
+                    count++;
+                }
+            }
+            continue;
+        }
+
+        struct dirent **names;
+        const int entries = scandir(sources[i], &names, skip_hidden_files, alphasort);
+        if (entries < 0) {
+            fprintf(stderr, "Could not read image directory \"%s\"\n", sources[i]);
+            continue;
+        }
+        char **grown = realloc(list, (count + entries) * sizeof(char *));
+        if (grown != NULL) {
+            list = grown;
+        }
+        for (int j = 0; j < entries; j++) {
+            if (grown != NULL && asprintf(&list[count], "%s/%s", sources[i], names[j]->d_name) != -1) {
+                count++;
+            }
+            free(names[j]);
+        }
+        free(names);
+    }
+
+    *result = list;
+    return count;
+}
+
+char *slideshow_init(const char *image_raw_format, double seconds) {
+    for (int i = 0; i < num_sources; i++) {
+        if (strcmp(sources[i], "-") == 0) {
+            if (num_sources > 1) {
+                fprintf(stderr, "An image read from stdin cannot be combined with other images\n");
+                return NULL;
+            }
+            /* Can only be read once, so there is nothing to rotate or reload. */
+            return strdup("-");
+        }
+    }
+
+    num_paths = read_paths(&paths);
+    if (num_paths == 0) {
+        fprintf(stderr, "No images found\n");
+        return NULL;
+    }
+
+    raw_format = (image_raw_format != NULL ? strdup(image_raw_format) : NULL);
+    interval = seconds;
+    if (num_paths > 1) {
+        DEBUG("slideshow: %d images, changing every %.0f s\n", num_paths, interval);
+    }
+
+    return strdup(paths[0]);
+}
+
+static void free_slide(struct slide *slide) {
+    if (slide == NULL) {
+        return;
+    }
+    if (slide->surface != NULL) {
+        cairo_surface_destroy(slide->surface);
+    }
+    free_scaled_images(slide->scaled);
+    free(slide);
+}
+
+/*
+ * Loads the image of a job and prepares it like load_background_image() and
+ * draw_scaled_images() would, so that the main thread only needs to swap it
+ * in. Runs on the loading thread.
+ *
+ */
+static struct slide *load_slide(const struct job *job) {
+    struct slide *slide = calloc(1, sizeof(struct slide));
+    if (slide == NULL) {
+        return NULL;
+    }
+    slide->generation = job->generation;
+    slide->index = job->index;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    slide->surface = load_image(job->path, raw_format, (job->scaled ? job->resolution : NULL));
+    if (slide->surface == NULL) {
+        return slide;
+    }
+
+    if (scaling_mode != SCALING_NONE) {
+        slide->scaled = scale_image(slide->surface, job->monitors, job->num_monitors);
+    } else if (cairo_surface_get_type(slide->surface) == CAIRO_SURFACE_TYPE_IMAGE) {
+        /* Like fit_image_to_resolution(), only keep what is visible. */
+        const int width = cairo_image_surface_get_width(slide->surface);
+        const int height = cairo_image_surface_get_height(slide->surface);
+        const int visible_width = (width < (int)job->resolution[0] ? width : (int)job->resolution[0]);
+        const int visible_height = (height < (int)job->resolution[1] ? height : (int)job->resolution[1]);
+        cairo_surface_t *cropped;
+        if ((visible_width != width || visible_height != height) &&
+            (cropped = crop_image(slide->surface, visible_width, visible_height)) != NULL) {
+            cairo_surface_destroy(slide->surface);
+            slide->surface = cropped;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    DEBUG("slideshow: prepared \"%s\" in %.1f ms\n", job->path,
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return slide;
+}
+
+/*
+ * The loading thread: loads the images requested by request_slide(), one at a
+ * time, and hands them to the main thread via loaded_async.
+ *
+ */
+static void *load_slides(void *arg) {
+    pthread_mutex_lock(&slides_lock);
+    while (true) {
+        while (pending == NULL) {
+            pthread_cond_wait(&slides_cond, &slides_lock);
+        }
+        struct job *job = pending;
+        pending = NULL;
+        pthread_mutex_unlock(&slides_lock);
+
+        struct slide *slide = load_slide(job);
+        free(job->path);
+        free(job);
+
+        pthread_mutex_lock(&slides_lock);
+        if (slide != NULL) {
+            /* An older slide which the main thread did not pick up yet is
+             * outdated by now. */
+            free_slide(loaded);
+            loaded = slide;
+            ev_async_send(slideshow_loop, &loaded_async);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Asks the loading thread to load the image with the given index. Replaces any
+ * request which the thread did not start on yet.
+ *
+ */
+static void request_slide(int index) {
+    const int screens = get_monitors(NULL, 0);
+    struct job *job = calloc(1, sizeof(struct job) + screens * sizeof(Rect));
+    if (job == NULL || (job->path = strdup(paths[index])) == NULL) {
+        free(job);
+        return;
+    }
+    job->generation = generation;
+    job->index = index;
+    job->resolution[0] = last_resolution[0];
+    job->resolution[1] = last_resolution[1];
+    job->scaled = (scaling_mode == SCALING_FILL || scaling_mode == SCALING_FIT ||
+                   scaling_mode == SCALING_STRETCH);
+    job->num_monitors = get_monitors(job->monitors, screens);
+
+    pthread_mutex_lock(&slides_lock);
+    if (pending != NULL) {
+        free(pending->path);
+        free(pending);
+    }
+    pending = job;
+    pthread_cond_signal(&slides_cond);
+    pthread_mutex_unlock(&slides_lock);
+    loading = true;
+}
+
+static void request_next_slide(void) {
+    if (num_paths > 1) {
+        request_slide((current + 1) % num_paths);
+    }
+}
+
+static void show_slide(struct slide *slide) {
+    cairo_surface_destroy(img);
+    img = slide->surface;
+    use_scaled_images(slide->scaled);
+    invalidate_background();
+    current = slide->index;
+    free(slide);
+    redraw_screen();
+}
+
+static void slide_loaded(EV_P_ ev_async *w, int revents) {
+    trace_instant("slide_loaded");
+    pthread_mutex_lock(&slides_lock);
+    struct slide *slide = loaded;
+    loaded = NULL;
+    pthread_mutex_unlock(&slides_lock);
+
+    if (slide == NULL) {
+        return;
+    }
+    if (slide->generation != generation) {
+        free_slide(slide);
+        return;
+    }
+    loading = false;
+
+    if (slide->surface == NULL) {
+        /* Skip images which cannot be loaded. When reloading the current
+         * image failed, it stays on screen. */
+        const int following = (slide->index + 1) % num_paths;
+        if (slide->index == current) {
+            request_next_slide();
+        } else if (following != current) {
+            request_slide(following);
+        }
+        free_slide(slide);
+        return;
+    }
+
+    if (slide->index == current || show_when_loaded) {
+        show_when_loaded = false;
+        show_slide(slide);
+        request_next_slide();
+    } else {
+        free_slide(next);
+        next = slide;
+    }
+}
+
+static void show_next_slide(EV_P_ ev_timer *w, int revents) {
+    trace_instant("slideshow_timeout");
+    if (num_paths < 2) {
+        return;
+    }
+    if (next != NULL) {
+        struct slide *slide = next;
+        next = NULL;
+        show_slide(slide);
+        request_next_slide();
+        return;
+    }
+
+    DEBUG("slideshow: next image is not loaded yet\n");
+    show_when_loaded = true;
+    if (!loading) {
+        request_next_slide();
+    }
+}
+
+bool slideshow_reload(void) {
+    if (slideshow_loop == NULL) {
+        return false;
+    }
+    generation++;
+    free_slide(next);
+    next = NULL;
+    request_slide(current);
+    return true;
+}
+
+bool slideshow_reread(void) {
+    if (slideshow_loop == NULL) {
+        return false;
+    }
+    DEBUG("slideshow: reading the images again\n");
+
+    char **list;
+    const int count = read_paths(&list);
+    if (count == 0) {
+        fprintf(stderr, "No images found, keeping the current image\n");
+        free(list);
+        return true;
+    }
+
+    /* Stay at the current image if it still exists. */
+    int index = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i], paths[current]) == 0) {
+            index = i;
+            break;
+        }
+    }
+    free_paths(paths, num_paths);
+    paths = list;
+    num_paths = count;
+    current = index;
+
+    return slideshow_reload();
+}
+
+/*
+ * Returns true if the images can ever change: there is more than one, or more
+ * can show up in a directory on SIGHUP.
+ *
+ */
+static bool images_can_change(void) {
+    if (num_paths > 1) {
+        return true;
+    }
+    for (int i = 0; i < num_sources; i++) {
+        struct stat st;
+        if (stat(sources[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void slideshow_start(struct ev_loop *loop) {
+    /* A single image is handled like any other image, including the cache
+     * when it needs to be loaded again. */
+    if (slideshow_loop != NULL || num_paths == 0 || !images_can_change()) {
+        return;
+    }
+
+    /* Must be set before the thread can call ev_async_send(). */
+    slideshow_loop = loop;
+    ev_async_init(&loaded_async, slide_loaded);
+    ev_async_start(loop, &loaded_async);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, load_slides, NULL) != 0) {
+        fprintf(stderr, "Could not start the slideshow thread, showing the first image only\n");
+        ev_async_stop(loop, &loaded_async);
+        slideshow_loop = NULL;
+        return;
+    }
+    pthread_detach(thread);
+
+    ev_timer_init(&slide_timer, show_next_slide, interval, interval);
+    ev_timer_start(loop, &slide_timer);
+    request_next_slide();
+}
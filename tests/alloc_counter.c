@@ -0,0 +1,227 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * alloc_counter.c: LD_PRELOAD library for alloc_test, which counts
+ *                  - heap allocations whose first caller outside of libc is
+ *                    the i3lock executable (i.e. including strdup() etc.),
+ *                  - calls of the cairo functions which create objects.
+ *                  On SIGUSR1, the counts are written to the file named by
+ *                  $I3LOCK_ALLOC_COUNTS.
+ *
+ */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cairo.h>
+#include <cairo/cairo-xcb.h>
+
+/* The allocator behind malloc() etc., so that they can be replaced without
+ * dlsym(), which allocates itself. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+#define MAX_RANGES 8
+#define MAX_FRAMES 32
+
+struct ranges {
+    int count;
+    uintptr_t start[MAX_RANGES];
+    uintptr_t end[MAX_RANGES];
+};
+
+/* Where the code of the i3lock executable, of libc and of this library is. */
+static struct ranges executable;
+static struct ranges libc;
+static struct ranges self;
+
+static atomic_ulong allocations;
+static atomic_ulong cairo_objects;
+
+/* Set while counting, so that allocations of backtrace() are not counted. */
+static __thread bool counting;
+
+static char output[4096];
+static char output_tmp[4096 + 4];
+
+static bool in_ranges(const struct ranges *ranges, uintptr_t address) {
+    for (int i = 0; i < ranges->count; i++) {
+        if (address >= ranges->start[i] && address < ranges->end[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int find_code(struct dl_phdr_info *info, size_t size, void *data) {
+    struct ranges *ranges;
+    if (*(int *)data == 0) {
+        /* The first object is the executable. */
+        ranges = &executable;
+    } else if (strstr(info->dlpi_name, "/libc.so") != NULL) {
+        ranges = &libc;
+    } else {
+        ranges = NULL;
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+            const uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+            if (phdr->p_type == PT_LOAD && (uintptr_t)find_code >= start && (uintptr_t)find_code < start + phdr->p_memsz) {
+                ranges = &self;
+            }
+        }
+    }
+    (*(int *)data)++;
+    if (ranges == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < info->dlpi_phnum && ranges->count < MAX_RANGES; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+            ranges->start[ranges->count] = info->dlpi_addr + phdr->p_vaddr;
+            ranges->end[ranges->count] = info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz;
+            ranges->count++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes number to fd, from a signal handler.
+ *
+ */
+static void write_number(int fd, unsigned long number) {
+    char buf[32];
+    int pos = sizeof(buf);
+    buf[--pos] = '\n';
+    do {
+        buf[--pos] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+    (void)!write(fd, buf + pos, sizeof(buf) - pos);
+}
+
+static void dump_counts(int sig) {
+    const int fd = open(output_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return;
+    }
+    write_number(fd, atomic_load(&allocations));
+    write_number(fd, atomic_load(&cairo_objects));
+    close(fd);
+    /* Renaming makes the complete file appear at once. */
+    rename(output_tmp, output);
+}
+
+__attribute__((constructor)) static void init(void) {
+    counting = true;
+    int index = 0;
+    dl_iterate_phdr(find_code, &index);
+    /* The first backtrace() loads the unwinder, which allocates. */
+    void *frames[2];
+    backtrace(frames, 2);
+    counting = false;
+
+    const char *path = getenv("I3LOCK_ALLOC_COUNTS");
+    if (path == NULL || strlen(path) >= sizeof(output)) {
+        return;
+    }
+    strcpy(output, path);
+    snprintf(output_tmp, sizeof(output_tmp), "%s.tmp", path);
+    struct sigaction action = {.sa_handler = dump_counts, .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+static void count_allocation(void) {
+    if (counting || executable.count == 0) {
+        return;
+    }
+    counting = true;
+    void *frames[MAX_FRAMES];
+    const int count = backtrace(frames, MAX_FRAMES);
+    for (int i = 0; i < count; i++) {
+        const uintptr_t address = (uintptr_t)frames[i];
+        if (in_ranges(&self, address) || in_ranges(&libc, address)) {
+            continue;
+        }
+        if (in_ranges(&executable, address)) {
+            atomic_fetch_add(&allocations, 1);
+        }
+        break;
+    }
+    counting = false;
+}
+
+void *malloc(size_t size) {
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count_allocation();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+/* Counts a call of the cairo function name, and looks up the real one.
+ * cairo calls its own functions directly, so all calls which end up here
+ * are made by i3lock. */
+#define COUNT_CAIRO(name)                                                \
+    static __typeof__(name) *real = NULL;                                \
+    if (real == NULL) {                                                  \
+        real = (__typeof__(name) *)dlsym(RTLD_NEXT, #name);              \
+    }                                                                    \
+    atomic_fetch_add(&cairo_objects, 1)
+
+cairo_t *cairo_create(cairo_surface_t *target) {
+    COUNT_CAIRO(cairo_create);
+    return real(target);
+}
+
+cairo_surface_t *cairo_image_surface_create(cairo_format_t format, int width, int height) {
+    COUNT_CAIRO(cairo_image_surface_create);
+    return real(format, width, height);
+}
+
+cairo_surface_t *cairo_xcb_surface_create(xcb_connection_t *connection, xcb_drawable_t drawable,
+                                          xcb_visualtype_t *visual, int width, int height) {
+    COUNT_CAIRO(cairo_xcb_surface_create);
+    return real(connection, drawable, visual, width, height);
+}
+
+cairo_surface_t *cairo_surface_create_similar(cairo_surface_t *other, cairo_content_t content,
+                                              int width, int height) {
+    COUNT_CAIRO(cairo_surface_create_similar);
+    return real(other, content, width, height);
+}
+
+cairo_surface_t *cairo_surface_create_similar_image(cairo_surface_t *other, cairo_format_t format,
+                                                    int width, int height) {
+    COUNT_CAIRO(cairo_surface_create_similar_image);
+    return real(other, format, width, height);
+}
+
+cairo_pattern_t *cairo_pattern_create_for_surface(cairo_surface_t *surface) {
+    COUNT_CAIRO(cairo_pattern_create_for_surface);
+    return real(surface);
+}
+
+void cairo_set_source_surface(cairo_t *cr, cairo_surface_t *surface, double x, double y) {
+    COUNT_CAIRO(cairo_set_source_surface);
+    real(cr, surface, x, y);
+}
@@ -0,0 +1,124 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * alloc_test.c: checks that i3lock does not allocate memory or create cairo
+ *               objects when handling a key press, once it has drawn every
+ *               state at least once. The allocations are counted by
+ *               alloc_counter.c, which is preloaded into i3lock.
+ *
+ * Usage: alloc_test <path to i3lock> <path to alloc_counter>
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <signal.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "xvfb.h"
+
+/* Key presses to warm up with, and key presses which must not allocate. */
+#define WARMUP_KEYS 10
+#define KEYS 20
+/* How long to wait for i3lock to react before failing. */
+#define TIMEOUT_MS 5000
+/* Longer than the highlight of a key press is shown (250 ms), so that the
+ * redraw removing it is included. */
+#define SETTLE_MS 400
+
+#define XK_a 0x0061
+
+struct counts {
+    unsigned long allocations;
+    unsigned long cairo_objects;
+};
+
+/*
+ * Makes i3lock write its counts to path and reads them.
+ *
+ */
+static struct counts read_counts(pid_t pid, const char *path) {
+    unlink(path);
+    kill(pid, SIGUSR1);
+    FILE *f = NULL;
+    for (int i = 0; i < TIMEOUT_MS && (f = fopen(path, "r")) == NULL; i++) {
+        usleep(1000);
+    }
+    if (f == NULL) {
+        errx(EXIT_FAILURE, "i3lock did not write %s, is alloc_counter preloaded?", path);
+    }
+    struct counts counts;
+    if (fscanf(f, "%lu %lu", &counts.allocations, &counts.cairo_objects) != 2) {
+        errx(EXIT_FAILURE, "cannot parse %s", path);
+    }
+    fclose(f);
+    return counts;
+}
+
+static void type_keys(struct xvfb *xvfb, pid_t pid, xcb_keycode_t keycode, int keys) {
+    for (int i = 0; i < keys; i++) {
+        press_key(xvfb, keycode);
+        if (!wait_for_damage(xvfb, TIMEOUT_MS)) {
+            stop_i3lock(pid);
+            errx(EXIT_FAILURE, "i3lock did not draw after a key press");
+        }
+        drain_events(xvfb, 20);
+    }
+    drain_events(xvfb, SETTLE_MS);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        errx(EXIT_FAILURE, "usage: %s <path to i3lock> <path to alloc_counter>", argv[0]);
+    }
+
+    struct xvfb xvfb;
+    xvfb_start(&xvfb, 1, 1280, 720);
+    const xcb_keycode_t key_a = keysym_to_keycode(&xvfb, XK_a);
+
+    char dir[] = "/tmp/i3lock-alloc-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        err(EXIT_FAILURE, "mkdtemp");
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%s/counts", dir);
+    setenv("I3LOCK_ALLOC_COUNTS", path, 1);
+    setenv("LD_PRELOAD", argv[2], 1);
+
+    const pid_t pid = spawn_i3lock(argv[1], (const char *const[]){NULL}, -1);
+    unsetenv("LD_PRELOAD");
+    const xcb_window_t win = wait_for_map(&xvfb, TIMEOUT_MS);
+    if (win == XCB_NONE) {
+        stop_i3lock(pid);
+        errx(EXIT_FAILURE, "i3lock did not map its window");
+    }
+    watch_damage(&xvfb, win);
+    if (!wait_for_damage(&xvfb, TIMEOUT_MS)) {
+        stop_i3lock(pid);
+        errx(EXIT_FAILURE, "i3lock did not draw after grabbing the keyboard");
+    }
+    drain_events(&xvfb, 50);
+
+    type_keys(&xvfb, pid, key_a, WARMUP_KEYS);
+    const struct counts before = read_counts(pid, path);
+    type_keys(&xvfb, pid, key_a, KEYS);
+    const struct counts after = read_counts(pid, path);
+
+    stop_i3lock(pid);
+    xvfb_stop(&xvfb);
+    unlink(path);
+    rmdir(dir);
+
+    printf("%d key presses: %lu heap allocations, %lu cairo objects created\n",
+           KEYS, after.allocations - before.allocations, after.cairo_objects - before.cairo_objects);
+    if (after.allocations != before.allocations || after.cairo_objects != before.cairo_objects) {
+        printf("FAIL: key presses must not allocate\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
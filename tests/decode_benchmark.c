@@ -0,0 +1,226 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * decode_benchmark.c: measures how long load_image() takes to decode the same
+ *                     picture as PNG and as JPEG (at full and at reduced
+ *                     resolution), and how much memory that needs.
+ *
+ * Run with: meson test -C build --benchmark decode
+ *
+ */
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <cairo.h>
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+#include "i3lock.h"
+#include "image.h"
+
+/* Decodes per case, unless given as the first argument. */
+#define DEFAULT_RUNS 5
+
+static const int sizes[][2] = {
+    {1920, 1080},
+    {3840, 2160},
+    {7680, 4320},
+};
+
+#ifdef HAVE_LIBJPEG
+/* The screen a reduced decode has to cover, as with --scaling=fill on a 1080p
+ * monitor. */
+static const uint32_t screen_size[2] = {1920, 1080};
+#endif
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns a picture with a gradient and some noise, which compresses about as
+ * well as a photo does.
+ *
+ */
+static cairo_surface_t *create_test_image(int width, int height) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_surface_flush(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    srand(42);
+    for (int y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t *)(data + y * stride);
+        for (int x = 0; x < width; x++) {
+            const int noise = rand() % 24;
+            const uint32_t r = (x * 200 / width) + noise;
+            const uint32_t g = (y * 200 / height) + noise;
+            const uint32_t b = ((x + y) * 100 / (width + height)) + 100 + noise;
+            row[x] = (r << 16) | (g << 8) | b;
+        }
+    }
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
+#ifdef HAVE_LIBJPEG
+static void write_jpeg(cairo_surface_t *surface, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        err(EXIT_FAILURE, "fopen(%s)", path);
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    cinfo.image_width = cairo_image_surface_get_width(surface);
+    cinfo.image_height = cairo_image_surface_get_height(surface);
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    const unsigned char *data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    JSAMPLE *rgb = malloc(cinfo.image_width * 3);
+    if (rgb == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint32_t *row = (const uint32_t *)(data + cinfo.next_scanline * stride);
+        for (JDIMENSION x = 0; x < cinfo.image_width; x++) {
+            rgb[x * 3 + 0] = (row[x] >> 16) & 0xff;
+            rgb[x * 3 + 1] = (row[x] >> 8) & 0xff;
+            rgb[x * 3 + 2] = row[x] & 0xff;
+        }
+        jpeg_write_scanlines(&cinfo, &rgb, 1);
+    }
+    free(rgb);
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(f);
+}
+#endif
+
+/*
+ * Decodes the image at path runs times in a process of its own, so that the
+ * peak RSS only covers this case, and prints the results.
+ *
+ */
+static void run_case(const char *name, const char *path, const uint32_t *min_size, int runs) {
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == -1) {
+        err(EXIT_FAILURE, "fork");
+    }
+    if (pid > 0) {
+        int status;
+        if (waitpid(pid, &status, 0) == -1) {
+            err(EXIT_FAILURE, "waitpid");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            errx(EXIT_FAILURE, "decoding %s failed", path);
+        }
+        return;
+    }
+
+    double *times = calloc(runs, sizeof(double));
+    if (times == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+    const long rss_before = current_rss_kib();
+    int width = 0, height = 0;
+    for (int i = 0; i < runs; i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        cairo_surface_t *img = load_image(path, NULL, min_size);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (img == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        width = cairo_image_surface_get_width(img);
+        height = cairo_image_surface_get_height(img);
+        cairo_surface_destroy(img);
+        times[i] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    }
+    qsort(times, runs, sizeof(double), compare_doubles);
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        err(EXIT_FAILURE, "stat(%s)", path);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-12s %4dx%-4d %10lld %9.1f %9.1f %12ld %12ld\n",
+           name, width, height, (long long)st.st_size / 1024,
+           times[runs / 2], times[runs - 1], rss_before, usage.ru_maxrss);
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    if (argc > 1 && (runs = atoi(argv[1])) < 1) {
+        errx(EXIT_FAILURE, "usage: %s [decodes per case]", argv[0]);
+    }
+
+    char dir[] = "/tmp/i3lock-decode-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        err(EXIT_FAILURE, "mkdtemp");
+    }
+
+    printf("load_image(), %d decodes per case, times in ms, RSS in KiB\n", runs);
+    printf("%-12s %-9s %10s %9s %9s %12s %12s\n",
+           "format", "decoded", "file KiB", "p50", "max", "RSS before", "peak RSS");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        char png_path[64], jpeg_path[64];
+        snprintf(png_path, sizeof(png_path), "%s/%dx%d.png", dir, sizes[s][0], sizes[s][1]);
+        snprintf(jpeg_path, sizeof(jpeg_path), "%s/%dx%d.jpg", dir, sizes[s][0], sizes[s][1]);
+
+        /* The picture is freed before decoding, so that it does not count
+         * towards the RSS of the decoding processes. */
+        cairo_surface_t *picture = create_test_image(sizes[s][0], sizes[s][1]);
+        if (cairo_surface_write_to_png(picture, png_path) != CAIRO_STATUS_SUCCESS) {
+            errx(EXIT_FAILURE, "could not write %s", png_path);
+        }
+#ifdef HAVE_LIBJPEG
+        write_jpeg(picture, jpeg_path);
+#endif
+        cairo_surface_destroy(picture);
+
+        run_case("png", png_path, NULL, runs);
+#ifdef HAVE_LIBJPEG
+        run_case("jpeg", jpeg_path, NULL, runs);
+        run_case("jpeg-scaled", jpeg_path, screen_size, runs);
+        unlink(jpeg_path);
+#endif
+        unlink(png_path);
+    }
+
+#ifndef HAVE_LIBJPEG
+    printf("built without libjpeg, skipped JPEG\n");
+#endif
+
+    rmdir(dir);
+    return EXIT_SUCCESS;
+}
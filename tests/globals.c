@@ -0,0 +1,33 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * globals.c: the variables which i3lock.c defines for the other modules, with
+ *            their defaults, for tests and benchmarks which link against
+ *            i3lock_common instead of i3lock.c.
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+#include <xkbcommon/xkbcommon.h>
+#include <cairo.h>
+
+#include "background.h"
+
+char color[7] = "a3a3a3";
+uint32_t last_resolution[2];
+xcb_window_t win;
+int input_position = 0;
+bool debug_mode = false;
+bool unlock_indicator = true;
+int failed_attempts = 0;
+bool show_failed_attempts = false;
+bool show_keyboard_layout = false;
+struct xkb_state *xkb_state;
+struct xkb_keymap *xkb_keymap;
+cairo_surface_t *img = NULL;
+bool tile = false;
+bool low_memory = false;
+scaling_mode_t scaling_mode = SCALING_NONE;
@@ -0,0 +1,197 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * latency_test.c: locks an Xvfb server with i3lock and measures how long
+ *                 locking takes, how long it takes from a key press until
+ *                 i3lock has drawn the lock window again, and how long
+ *                 unlocking takes.
+ *
+ * Unlocking requires i3lock to be built with a PAM service which accepts any
+ * password (-Dpam_service=…, using pam_permit), otherwise it is not measured.
+ *
+ * Every screen layout (number of monitors and their resolution) is measured on
+ * its own Xvfb server. By default, a few common layouts are measured; a single
+ * one can be given on the command line instead.
+ *
+ * Usage: latency_test <path to i3lock> [<monitors> <width>x<height>]
+ *
+ */
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <sys/wait.h>
+#include <xcb/xcb.h>
+
+#include "xvfb.h"
+
+/* Lock/unlock cycles, and keys typed per cycle. */
+#define CYCLES 5
+#define KEYS 40
+/* How long to wait for i3lock to react before failing. */
+#define TIMEOUT_MS 5000
+
+#define XK_a 0x0061
+#define XK_Return 0xff0d
+
+/* The maximum xvfb_start() supports. */
+#define MAX_MONITORS 4
+
+struct layout {
+    int monitors;
+    int width;
+    int height;
+};
+
+/* Measured unless a layout is given on the command line. */
+static const struct layout default_layouts[] = {
+    {1, 1920, 1080},
+    {2, 1920, 1080},
+    {4, 1920, 1080},
+    {1, 3840, 2160},
+};
+
+/*
+ * Returns whether the PAM service i3lock was built with accepts any password,
+ * so that the test can unlock.
+ *
+ */
+static bool pam_service_permits(void) {
+    char path[256];
+    snprintf(path, sizeof(path), "/etc/pam.d/%s", I3LOCK_PAM_SERVICE);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    bool permits = false;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "auth", strlen("auth")) == 0 && strstr(line, "pam_permit.so") != NULL) {
+            permits = true;
+        }
+    }
+    fclose(f);
+    return permits;
+}
+
+static void print_percentiles(const char *name, double *values, int n) {
+    printf("  %-18s p50 %7.2f ms   p90 %7.2f ms   p99 %7.2f ms   max %7.2f ms   (n = %d)\n",
+           name, percentile(values, n, 0.5), percentile(values, n, 0.9),
+           percentile(values, n, 0.99), percentile(values, n, 1.0), n);
+}
+
+/*
+ * Locks and unlocks an Xvfb server with the given layout CYCLES times and
+ * prints the latencies.
+ *
+ */
+static void measure_layout(const char *i3lock, const struct layout *layout, bool can_unlock) {
+    struct xvfb xvfb;
+    xvfb_start(&xvfb, layout->monitors, layout->width, layout->height);
+    const xcb_keycode_t key_a = keysym_to_keycode(&xvfb, XK_a);
+    const xcb_keycode_t key_return = keysym_to_keycode(&xvfb, XK_Return);
+
+    double map_times[CYCLES], lock_times[CYCLES], unlock_times[CYCLES];
+    double key_times[CYCLES * KEYS];
+    int keys = 0;
+
+    for (int cycle = 0; cycle < CYCLES; cycle++) {
+        const double start = now_ms();
+        const pid_t pid = spawn_i3lock(i3lock, (const char *const[]){NULL}, -1);
+
+        const xcb_window_t win = wait_for_map(&xvfb, TIMEOUT_MS);
+        if (win == XCB_NONE) {
+            stop_i3lock(pid);
+            errx(EXIT_FAILURE, "i3lock did not map its window");
+        }
+        map_times[cycle] = now_ms() - start;
+
+        /* i3lock maps its window with the first frame as background, then
+         * grabs the keyboard and draws the window again. */
+        watch_damage(&xvfb, win);
+        if (!wait_for_damage(&xvfb, TIMEOUT_MS)) {
+            stop_i3lock(pid);
+            errx(EXIT_FAILURE, "i3lock did not draw after grabbing the keyboard");
+        }
+        lock_times[cycle] = now_ms() - start;
+        drain_events(&xvfb, 50);
+
+        for (int i = 0; i < KEYS; i++) {
+            const double pressed = now_ms();
+            press_key(&xvfb, key_a);
+            if (!wait_for_damage(&xvfb, TIMEOUT_MS)) {
+                stop_i3lock(pid);
+                errx(EXIT_FAILURE, "i3lock did not draw after a key press");
+            }
+            key_times[keys++] = now_ms() - pressed;
+            /* Each key press is drawn once; wait for stray redraws before
+             * the next one, well below the highlight timeout of 250 ms. */
+            drain_events(&xvfb, 20);
+        }
+
+        if (!can_unlock) {
+            stop_i3lock(pid);
+            continue;
+        }
+
+        const double unlocking = now_ms();
+        press_key(&xvfb, key_return);
+        if (!wait_for_unmap(&xvfb, win, TIMEOUT_MS)) {
+            stop_i3lock(pid);
+            errx(EXIT_FAILURE, "i3lock did not unlock");
+        }
+        unlock_times[cycle] = now_ms() - unlocking;
+        const int status = stop_i3lock(pid);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            errx(EXIT_FAILURE, "i3lock did not exit successfully after unlocking");
+        }
+        drain_events(&xvfb, 50);
+    }
+
+    printf("%d x %dx%d:\n", layout->monitors, layout->width, layout->height);
+    print_percentiles("time to map", map_times, CYCLES);
+    print_percentiles("time to lock", lock_times, CYCLES);
+    print_percentiles("key to pixel", key_times, keys);
+    if (can_unlock) {
+        print_percentiles("time to unlock", unlock_times, CYCLES);
+    }
+    fflush(stdout);
+
+    xvfb_stop(&xvfb);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 4) {
+        errx(EXIT_FAILURE, "usage: %s <path to i3lock> [<monitors> <width>x<height>]", argv[0]);
+    }
+
+    const struct layout *layouts = default_layouts;
+    int num_layouts = sizeof(default_layouts) / sizeof(default_layouts[0]);
+    struct layout given;
+    if (argc == 4) {
+        given.monitors = atoi(argv[2]);
+        if (given.monitors < 1 || given.monitors > MAX_MONITORS ||
+            sscanf(argv[3], "%dx%d", &given.width, &given.height) != 2 ||
+            given.width <= 0 || given.height <= 0) {
+            errx(EXIT_FAILURE, "invalid layout \"%s %s\", expected 1 to %d monitors and <width>x<height>",
+                 argv[2], argv[3], MAX_MONITORS);
+        }
+        layouts = &given;
+        num_layouts = 1;
+    }
+
+    const bool can_unlock = pam_service_permits();
+    if (!can_unlock) {
+        printf("PAM service \"%s\" does not use pam_permit, not measuring unlocking\n", I3LOCK_PAM_SERVICE);
+    }
+
+    for (int i = 0; i < num_layouts; i++) {
+        measure_layout(argv[1], &layouts[i], can_unlock);
+    }
+    return EXIT_SUCCESS;
+}
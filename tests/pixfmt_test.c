@@ -0,0 +1,137 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * pixfmt_test.c: checks that every converter of every pre-defined raw pixel
+ *                format (scalar, SSSE3, AVX2) produces exactly the same output
+ *                as raw_pixel_format_convert_generic(), including for widths
+ *                which leave a tail for the scalar code.
+ *
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pixfmt.h"
+
+/* Written after the last pixel, must not be overwritten. */
+#define CANARY 0xdeadbeef
+#define CANARY_PIXELS 16
+
+static const struct raw_pixel_format *formats[] = {
+    &raw_fmt_rgb,
+    &raw_fmt_rgbx,
+    &raw_fmt_xrgb,
+    &raw_fmt_bgr,
+    &raw_fmt_bgrx,
+    &raw_fmt_xbgr,
+};
+
+static bool impl_supported(pixfmt_impl_t impl) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    switch (impl) {
+        case PIXFMT_IMPL_SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case PIXFMT_IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        default:
+            return true;
+    }
+#else
+    return impl == PIXFMT_IMPL_SCALAR;
+#endif
+}
+
+/*
+ * Converts one random row of the given width with converter and with the
+ * reference implementation, and compares the results.
+ *
+ */
+static bool check_row(const struct raw_pixel_format *fmt, pixfmt_impl_t impl, size_t width) {
+    /* Exactly the size of the row, so that reading past its end is caught by
+     * AddressSanitizer (meson configure -Db_sanitize=address). */
+    unsigned char *src = malloc(width > 0 ? width * fmt->bpp : 1);
+    uint32_t *expected = malloc((width > 0 ? width : 1) * sizeof(uint32_t));
+    uint32_t *actual = malloc((width + CANARY_PIXELS) * sizeof(uint32_t));
+    if (src == NULL || expected == NULL || actual == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < width * fmt->bpp; i++) {
+        src[i] = rand() & 0xff;
+    }
+    for (size_t i = 0; i < width + CANARY_PIXELS; i++) {
+        actual[i] = CANARY;
+    }
+
+    raw_pixel_format_convert_generic(fmt, expected, src, width);
+    fmt->convert[impl](actual, src, width);
+
+    bool ok = true;
+    for (size_t x = 0; x < width && ok; x++) {
+        if (actual[x] != expected[x]) {
+            fprintf(stderr, "FAIL: %s/%s, width %zu: pixel %zu is 0x%08x, expected 0x%08x\n",
+                    fmt->name, pixfmt_impl_name(impl), width, x, actual[x], expected[x]);
+            ok = false;
+        }
+    }
+    for (size_t x = width; x < width + CANARY_PIXELS && ok; x++) {
+        if (actual[x] != CANARY) {
+            fprintf(stderr, "FAIL: %s/%s, width %zu: wrote past the row (pixel %zu)\n",
+                    fmt->name, pixfmt_impl_name(impl), width, x);
+            ok = false;
+        }
+    }
+
+    free(src);
+    free(expected);
+    free(actual);
+    return ok;
+}
+
+int main(void) {
+    /* All widths up to a few SIMD iterations (so that every tail length is
+     * covered), plus some screen widths, odd and even. */
+    static const size_t large_widths[] = {1023, 1024, 1366, 1920, 2561, 3840, 7679, 7680};
+    int failures = 0;
+    int checked = 0;
+
+    srand(42);
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for (int impl = PIXFMT_IMPL_SCALAR; impl < PIXFMT_IMPL_MAX; impl++) {
+            if (formats[f]->convert[impl] == NULL || !impl_supported(impl)) {
+                printf("skipping %s/%s: not compiled in or not supported by this CPU\n",
+                       formats[f]->name, pixfmt_impl_name(impl));
+                continue;
+            }
+            for (size_t width = 0; width <= 67; width++) {
+                failures += !check_row(formats[f], impl, width);
+                checked++;
+            }
+            for (size_t i = 0; i < sizeof(large_widths) / sizeof(large_widths[0]); i++) {
+                failures += !check_row(formats[f], impl, large_widths[i]);
+                checked++;
+            }
+        }
+    }
+
+    /* The converter which is actually used must be the best one checked. */
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        pixfmt_convert_t best = formats[f]->convert[pixfmt_best_impl()];
+        if (best == NULL) {
+            best = formats[f]->convert[PIXFMT_IMPL_SCALAR];
+        }
+        if (raw_pixel_format_converter(formats[f]) != best) {
+            fprintf(stderr, "FAIL: %s: unexpected converter selected\n", formats[f]->name);
+            failures++;
+        }
+    }
+
+    printf("%d rows checked, %d failed (best implementation: %s)\n",
+           checked, failures, pixfmt_impl_name(pixfmt_best_impl()));
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,216 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * render_benchmark.c: measures how long draw_frame() takes to render the lock
+ *                     screen onto an image surface, for several resolutions,
+ *                     monitor layouts, DPI values, backgrounds and states,
+ *                     without an X server.
+ *
+ * Run with: meson test -C build --benchmark render
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <xcb/xcb.h>
+#include <xkbcommon/xkbcommon.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "unlock_indicator.h"
+#include "randr.h"
+#include "dpi.h"
+#include "background.h"
+
+/* Frames rendered per case, unless given as the first argument. */
+#define DEFAULT_FRAMES 10
+
+/*******************************************************************************
+ * Variables defined in tests/globals.c, xcb.c and unlock_indicator.c.
+ ******************************************************************************/
+
+extern cairo_surface_t *img;
+extern bool tile;
+
+extern xcb_screen_t *screen;
+extern unlock_state_t unlock_state;
+extern auth_state_t auth_state;
+
+static const uint32_t resolutions[][2] = {
+    {1920, 1080},
+    {2560, 1440},
+    {3840, 2160},
+    {7680, 4320},
+};
+
+/* Monitors per layout: side by side for 2, a 2x2 grid for 4. */
+static const int layouts[] = {1, 2, 4};
+
+static const long dpis[] = {96, 192};
+
+static const struct {
+    const char *name;
+    unlock_state_t unlock_state;
+    auth_state_t auth_state;
+} states[] = {
+    {"background", STATE_STARTED, STATE_AUTH_IDLE},
+    {"key_pressed", STATE_KEY_PRESSED, STATE_AUTH_IDLE},
+    {"key_active", STATE_KEY_ACTIVE, STATE_AUTH_IDLE},
+    {"backspace_active", STATE_BACKSPACE_ACTIVE, STATE_AUTH_IDLE},
+    {"nothing_to_delete", STATE_NOTHING_TO_DELETE, STATE_AUTH_IDLE},
+    {"verify", STATE_KEY_PRESSED, STATE_AUTH_VERIFY},
+    {"lock", STATE_STARTED, STATE_AUTH_LOCK},
+    {"wrong", STATE_KEY_PRESSED, STATE_AUTH_WRONG},
+    {"lock_failed", STATE_STARTED, STATE_I3LOCK_LOCK_FAILED},
+};
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    return sorted[(int)ceil(n * p) - 1];
+}
+
+/*
+ * Returns an image with a gradient, so that it does not compress or blend
+ * any better than a photo would.
+ *
+ */
+static cairo_surface_t *create_test_image(int width, int height) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *ctx = cairo_create(surface);
+    cairo_pattern_t *gradient = cairo_pattern_create_linear(0, 0, width, height);
+    cairo_pattern_add_color_stop_rgb(gradient, 0, 0.1, 0.2, 0.6);
+    cairo_pattern_add_color_stop_rgb(gradient, 1, 0.9, 0.6, 0.1);
+    cairo_set_source(ctx, gradient);
+    cairo_paint(ctx);
+    cairo_pattern_destroy(gradient);
+    cairo_destroy(ctx);
+    return surface;
+}
+
+/*
+ * Sets xr_screens/xr_resolutions as RandR would report the given number of
+ * equally sized monitors covering the resolution.
+ *
+ */
+static void set_layout(const uint32_t *resolution, int monitors) {
+    static Rect rects[4];
+    const int columns = (monitors == 1 ? 1 : 2);
+    const int rows = (monitors == 4 ? 2 : 1);
+    for (int i = 0; i < monitors; i++) {
+        rects[i].width = resolution[0] / columns;
+        rects[i].height = resolution[1] / rows;
+        rects[i].x = (i % columns) * rects[i].width;
+        rects[i].y = (i / columns) * rects[i].height;
+    }
+    xr_screens = monitors;
+    xr_resolutions = rects;
+}
+
+static void run_cases(long dpi, int frames) {
+    /* init_dpi() falls back to the screen size without an X connection. */
+    xcb_screen_t fake_screen = {
+        .height_in_pixels = dpi * 10,
+        .height_in_millimeters = 254,
+    };
+    screen = &fake_screen;
+    init_dpi();
+
+    double *times = calloc(frames, sizeof(double));
+    if (times == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+        uint32_t resolution[2] = {resolutions[r][0], resolutions[r][1]};
+        cairo_surface_t *target = cairo_image_surface_create(CAIRO_FORMAT_RGB24, resolution[0], resolution[1]);
+        cairo_t *ctx = cairo_create(target);
+
+        for (int background = 0; background < 2; background++) {
+            tile = (background == 1);
+            img = (tile ? create_test_image(256, 256) : create_test_image(resolution[0], resolution[1]));
+
+            for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+                set_layout(resolution, layouts[l]);
+
+                for (size_t s = 0; s < sizeof(states) / sizeof(states[0]); s++) {
+                    unlock_state = states[s].unlock_state;
+                    auth_state = states[s].auth_state;
+
+                    for (int i = 0; i < frames; i++) {
+                        struct timespec start, end;
+                        clock_gettime(CLOCK_MONOTONIC, &start);
+                        draw_frame(ctx, resolution);
+                        cairo_surface_flush(target);
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        times[i] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+                    }
+
+                    qsort(times, frames, sizeof(double), compare_doubles);
+                    printf("%4dx%-4d %8d %4ld %-6s %-18s %8.2f %8.2f %8.2f %8.2f\n",
+                           resolution[0], resolution[1], layouts[l], get_dpi_value(),
+                           (tile ? "tiled" : "image"), states[s].name,
+                           percentile(times, frames, 0.5), percentile(times, frames, 0.9),
+                           percentile(times, frames, 0.99), times[frames - 1]);
+                    fflush(stdout);
+                }
+            }
+
+            cairo_surface_destroy(img);
+            img = NULL;
+        }
+
+        cairo_destroy(ctx);
+        cairo_surface_destroy(target);
+    }
+
+    free(times);
+}
+
+int main(int argc, char *argv[]) {
+    int frames = DEFAULT_FRAMES;
+    if (argc > 1 && (frames = atoi(argv[1])) < 1) {
+        errx(EXIT_FAILURE, "usage: %s [frames per case]", argv[0]);
+    }
+
+    printf("draw_frame() onto an image surface, %d frames per case, latency in ms\n", frames);
+    printf("%-9s %8s %4s %-6s %-18s %8s %8s %8s %8s\n",
+           "size", "monitors", "dpi", "bg", "state", "p50", "p90", "p99", "max");
+    fflush(stdout);
+
+    /* The DPI is only determined once per process, so each DPI value gets a
+     * process of its own. */
+    for (size_t d = 0; d < sizeof(dpis) / sizeof(dpis[0]); d++) {
+        const pid_t pid = fork();
+        if (pid == -1) {
+            err(EXIT_FAILURE, "fork");
+        }
+        if (pid == 0) {
+            run_cases(dpis[d], frames);
+            exit(EXIT_SUCCESS);
+        }
+        int status;
+        if (waitpid(pid, &status, 0) == -1) {
+            err(EXIT_FAILURE, "waitpid");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            errx(EXIT_FAILURE, "rendering at %ld DPI failed", dpis[d]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
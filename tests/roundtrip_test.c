@@ -0,0 +1,108 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * roundtrip_test.c: types on i3lock running on Xvfb and checks that no key
+ *                   press needed a synchronous X11 round trip, i.e. that
+ *                   i3lock did not print a BUG warning (see
+ *                   include/roundtrips.h). Skipped unless i3lock was built
+ *                   with -Droundtrip_accounting=true.
+ *
+ * Usage: roundtrip_test <path to i3lock>
+ *
+ */
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "xvfb.h"
+
+/* Key presses per key to check. Every other one is followed by a pause, so
+ * that the redraw removing the highlight happens as well. */
+#define KEYS 20
+/* How long to wait for i3lock to react before failing. */
+#define TIMEOUT_MS 5000
+
+#define XK_a 0x0061
+#define XK_BackSpace 0xff08
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        errx(EXIT_FAILURE, "usage: %s <path to i3lock>", argv[0]);
+    }
+#ifndef I3LOCK_ROUNDTRIP_ACCOUNTING
+    printf("i3lock was built without -Droundtrip_accounting=true, skipping\n");
+    return EXIT_SKIP;
+#endif
+
+    struct xvfb xvfb;
+    xvfb_start(&xvfb, 1, 1280, 720);
+    const xcb_keycode_t keys[] = {
+        keysym_to_keycode(&xvfb, XK_a),
+        keysym_to_keycode(&xvfb, XK_BackSpace),
+    };
+
+    /* i3lock's stderr, which has the BUG warnings. */
+    char path[] = "/tmp/i3lock-roundtrips-XXXXXX";
+    const int stderr_fd = mkstemp(path);
+    if (stderr_fd == -1) {
+        err(EXIT_FAILURE, "mkstemp");
+    }
+
+    const pid_t pid = spawn_i3lock(argv[1], (const char *const[]){NULL}, stderr_fd);
+    close(stderr_fd);
+    const xcb_window_t win = wait_for_map(&xvfb, TIMEOUT_MS);
+    if (win == XCB_NONE) {
+        stop_i3lock(pid);
+        errx(EXIT_FAILURE, "i3lock did not map its window");
+    }
+    watch_damage(&xvfb, win);
+    if (!wait_for_damage(&xvfb, TIMEOUT_MS)) {
+        stop_i3lock(pid);
+        errx(EXIT_FAILURE, "i3lock did not draw after grabbing the keyboard");
+    }
+    drain_events(&xvfb, 50);
+
+    for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+        for (int i = 0; i < KEYS; i++) {
+            press_key(&xvfb, keys[k]);
+            if (!wait_for_damage(&xvfb, TIMEOUT_MS)) {
+                stop_i3lock(pid);
+                errx(EXIT_FAILURE, "i3lock did not draw after a key press");
+            }
+            drain_events(&xvfb, (i % 2 == 0 ? 20 : 300));
+        }
+    }
+    stop_i3lock(pid);
+    xvfb_stop(&xvfb);
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        err(EXIT_FAILURE, "fopen(%s)", path);
+    }
+    int bugs = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strstr(line, "BUG:") != NULL) {
+            fputs(line, stdout);
+            bugs++;
+        }
+    }
+    fclose(f);
+    unlink(path);
+
+    const int presses = KEYS * (int)(sizeof(keys) / sizeof(keys[0]));
+    printf("%d key presses, %d of them needed a synchronous X11 round trip\n", presses, bugs);
+    if (bugs > 0) {
+        printf("FAIL: key presses must not wait for the X server\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
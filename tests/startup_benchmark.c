@@ -0,0 +1,302 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * startup_benchmark.c: launches i3lock on Xvfb with different images, monitor
+ *                      counts and compose tables, and collects the startup
+ *                      milestones i3lock writes with --startup-json. The
+ *                      medians are printed and written to a JSON file.
+ *
+ * Usage: startup_benchmark <path to i3lock> [output.json]
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+
+#include "xvfb.h"
+
+/* Launches per case, the median of which is reported. */
+#define RUNS 5
+/* How long to wait for i3lock to lock the screen before failing. */
+#define TIMEOUT_MS 10000
+
+#define MONITOR_WIDTH 1920
+#define MONITOR_HEIGHT 1080
+
+/* The milestones from --startup-json, and the time from starting i3lock
+ * until the lock window was mapped as seen by the X server. */
+enum {
+    IMAGE_LOADED,
+    FIRST_FRAME,
+    GRABBED,
+    MAP_NOTIFY,
+    SPAWN_TO_MAP,
+    NUM_MILESTONES,
+};
+
+static const char *milestones[NUM_MILESTONES] = {
+    "image_loaded_ms",
+    "first_frame_ms",
+    "grabbed_ms",
+    "map_notify_ms",
+    "spawn_to_map_ms",
+};
+
+static const int monitor_counts[] = {1, 2, 4};
+
+static const char *raw_formats[] = {"native", "rgb", "xrgb", "rgbx", "bgr", "xbgr", "bgrx"};
+
+static const char *locales[] = {"C", "en_US.UTF-8", "de_DE.UTF-8", "ja_JP.UTF-8"};
+
+struct launch {
+    char name[64];
+    int monitors;
+    const char *locale;
+    bool compose;
+    /* --image, and --raw (if not NULL). */
+    const char *image;
+    const char *raw;
+    /* Whether the decoded image is already in i3lock's cache. */
+    bool cached;
+};
+
+/* Files which are created for the launches. */
+static char dir[] = "/tmp/i3lock-startup-XXXXXX";
+static char small_png[64], large_png[64], empty_compose[64], cache[64];
+static char raw_paths[sizeof(raw_formats) / sizeof(raw_formats[0])][64];
+static char raw_args[sizeof(raw_formats) / sizeof(raw_formats[0])][64];
+
+static void write_png(const char *path, int width, int height) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *ctx = cairo_create(surface);
+    cairo_pattern_t *gradient = cairo_pattern_create_linear(0, 0, width, height);
+    cairo_pattern_add_color_stop_rgb(gradient, 0, 0.1, 0.2, 0.6);
+    cairo_pattern_add_color_stop_rgb(gradient, 1, 0.9, 0.6, 0.1);
+    cairo_set_source(ctx, gradient);
+    cairo_paint(ctx);
+    cairo_pattern_destroy(gradient);
+    cairo_destroy(ctx);
+    if (cairo_surface_write_to_png(surface, path) != CAIRO_STATUS_SUCCESS) {
+        errx(EXIT_FAILURE, "could not write %s", path);
+    }
+    cairo_surface_destroy(surface);
+}
+
+static void write_raw(const char *path, int bytes) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        err(EXIT_FAILURE, "fopen(%s)", path);
+    }
+    for (int i = 0; i < bytes; i++) {
+        fputc(i % 251, f);
+    }
+    fclose(f);
+}
+
+static void create_files(void) {
+    if (mkdtemp(dir) == NULL) {
+        err(EXIT_FAILURE, "mkdtemp");
+    }
+    snprintf(small_png, sizeof(small_png), "%s/small.png", dir);
+    write_png(small_png, 640, 480);
+    snprintf(large_png, sizeof(large_png), "%s/large.png", dir);
+    write_png(large_png, 3840, 2160);
+    for (size_t i = 0; i < sizeof(raw_formats) / sizeof(raw_formats[0]); i++) {
+        const int bytes_per_pixel = (strlen(raw_formats[i]) == 3 ? 3 : 4);
+        snprintf(raw_paths[i], sizeof(raw_paths[i]), "%s/%s.raw", dir, raw_formats[i]);
+        write_raw(raw_paths[i], MONITOR_WIDTH * MONITOR_HEIGHT * bytes_per_pixel);
+        snprintf(raw_args[i], sizeof(raw_args[i]), "%dx%d:%s", MONITOR_WIDTH, MONITOR_HEIGHT, raw_formats[i]);
+    }
+    /* With an empty compose file, no compose table has to be parsed. */
+    snprintf(empty_compose, sizeof(empty_compose), "%s/Compose", dir);
+    write_raw(empty_compose, 0);
+    /* i3lock caches decoded images; each case picks its cache directory
+     * below this one. */
+    snprintf(cache, sizeof(cache), "%s/cache", dir);
+}
+
+static void remove_files(void) {
+    char command[128];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    if (system(command) != 0) {
+        warnx("could not remove %s", dir);
+    }
+}
+
+/*
+ * Launches i3lock once and stores its milestones. Returns false if i3lock did
+ * not report them.
+ *
+ */
+static bool launch_once(struct xvfb *xvfb, const char *i3lock, const struct launch *launch, double *values) {
+    int json[2];
+    if (pipe(json) != 0) {
+        err(EXIT_FAILURE, "pipe");
+    }
+    char json_arg[32];
+    snprintf(json_arg, sizeof(json_arg), "--startup-json=%d", json[1]);
+    const char *args[8] = {json_arg};
+    int argc = 1;
+    if (launch->image != NULL) {
+        args[argc++] = "-i";
+        args[argc++] = launch->image;
+    }
+    if (launch->raw != NULL) {
+        args[argc++] = "--raw";
+        args[argc++] = launch->raw;
+    }
+    args[argc] = NULL;
+
+    setenv("LC_ALL", launch->locale, 1);
+    if (launch->compose) {
+        unsetenv("XCOMPOSEFILE");
+    } else {
+        setenv("XCOMPOSEFILE", empty_compose, 1);
+    }
+
+    const double start = now_ms();
+    const pid_t pid = spawn_i3lock(i3lock, args, -1);
+    close(json[1]);
+    const xcb_window_t win = wait_for_map(xvfb, TIMEOUT_MS);
+    values[SPAWN_TO_MAP] = now_ms() - start;
+
+    bool reported = false;
+    if (win != XCB_NONE) {
+        FILE *f = fdopen(json[0], "r");
+        reported = (fscanf(f, "{\"image_loaded_ms\": %lf, \"first_frame_ms\": %lf, \"grabbed_ms\": %lf, \"map_notify_ms\": %lf}",
+                           &values[IMAGE_LOADED], &values[FIRST_FRAME], &values[GRABBED], &values[MAP_NOTIFY]) == 4);
+        fclose(f);
+    } else {
+        close(json[0]);
+    }
+    stop_i3lock(pid);
+    if (win != XCB_NONE) {
+        wait_for_unmap(xvfb, win, TIMEOUT_MS);
+    }
+    return reported;
+}
+
+static void run_launch(FILE *json, bool *first, struct xvfb *xvfb, const char *i3lock, const struct launch *launch) {
+    double values[NUM_MILESTONES][RUNS];
+    double run_values[NUM_MILESTONES];
+    char cache_dir[160];
+    if (launch->cached) {
+        /* One launch which is not measured fills the cache. */
+        snprintf(cache_dir, sizeof(cache_dir), "%s/%s-%d", cache, launch->name, launch->monitors);
+        setenv("XDG_CACHE_HOME", cache_dir, 1);
+        if (!launch_once(xvfb, i3lock, launch, run_values)) {
+            errx(EXIT_FAILURE, "%s: i3lock did not report its startup time", launch->name);
+        }
+    }
+    for (int run = 0; run < RUNS; run++) {
+        if (!launch->cached) {
+            /* A new, empty cache for each launch. */
+            snprintf(cache_dir, sizeof(cache_dir), "%s/%s-%d-%d", cache, launch->name, launch->monitors, run);
+            setenv("XDG_CACHE_HOME", cache_dir, 1);
+        }
+        if (!launch_once(xvfb, i3lock, launch, run_values)) {
+            errx(EXIT_FAILURE, "%s: i3lock did not report its startup time", launch->name);
+        }
+        for (int m = 0; m < NUM_MILESTONES; m++) {
+            values[m][run] = run_values[m];
+        }
+    }
+
+    printf("%-18s %8d %-12s %-7s", launch->name, launch->monitors, launch->locale, (launch->compose ? "on" : "off"));
+    fprintf(json, "%s\n    {\"case\": \"%s\", \"monitors\": %d, \"locale\": \"%s\", \"compose\": %s, \"runs\": %d",
+            (*first ? "" : ","), launch->name, launch->monitors, launch->locale,
+            (launch->compose ? "true" : "false"), RUNS);
+    *first = false;
+    for (int m = 0; m < NUM_MILESTONES; m++) {
+        const double median = percentile(values[m], RUNS, 0.5);
+        printf(" %9.1f", median);
+        fprintf(json, ", \"%s\": %.1f", milestones[m], median);
+    }
+    printf("\n");
+    fprintf(json, "}");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        errx(EXIT_FAILURE, "usage: %s <path to i3lock> [output.json]", argv[0]);
+    }
+    const char *output = (argc == 3 ? argv[2] : "startup.json");
+
+    FILE *json = NULL;
+    bool first = true;
+    for (size_t c = 0; c < sizeof(monitor_counts) / sizeof(monitor_counts[0]); c++) {
+        struct xvfb xvfb;
+        xvfb_start(&xvfb, monitor_counts[c], MONITOR_WIDTH, MONITOR_HEIGHT);
+        if (c == 0) {
+            /* Only now, so that the benchmark is skipped quickly and without
+             * leaving an incomplete file behind when Xvfb is missing. */
+            create_files();
+            if ((json = fopen(output, "w")) == NULL) {
+                err(EXIT_FAILURE, "fopen(%s)", output);
+            }
+            fprintf(json, "{\"runs_per_case\": %d, \"unit\": \"median ms\", \"cases\": [", RUNS);
+
+            printf("median of %d launches, in ms\n", RUNS);
+            printf("%-18s %8s %-12s %-7s", "case", "monitors", "locale", "compose");
+            for (int m = 0; m < NUM_MILESTONES; m++) {
+                printf(" %9.9s", milestones[m]);
+            }
+            printf("\n");
+        }
+
+        struct launch launch = {.monitors = monitor_counts[c], .locale = "C", .compose = true};
+        snprintf(launch.name, sizeof(launch.name), "no-image");
+        run_launch(json, &first, &xvfb, argv[1], &launch);
+
+        snprintf(launch.name, sizeof(launch.name), "small-png");
+        launch.image = small_png;
+        run_launch(json, &first, &xvfb, argv[1], &launch);
+
+        snprintf(launch.name, sizeof(launch.name), "large-png");
+        launch.image = large_png;
+        run_launch(json, &first, &xvfb, argv[1], &launch);
+
+        snprintf(launch.name, sizeof(launch.name), "large-png-cached");
+        launch.cached = true;
+        run_launch(json, &first, &xvfb, argv[1], &launch);
+        launch.cached = false;
+
+        for (size_t f = 0; f < sizeof(raw_formats) / sizeof(raw_formats[0]); f++) {
+            snprintf(launch.name, sizeof(launch.name), "raw-%s", raw_formats[f]);
+            launch.image = raw_paths[f];
+            launch.raw = raw_args[f];
+            run_launch(json, &first, &xvfb, argv[1], &launch);
+        }
+
+        /* The compose table does not depend on the monitors. */
+        if (monitor_counts[c] == 1) {
+            launch.image = NULL;
+            launch.raw = NULL;
+            for (size_t l = 0; l < sizeof(locales) / sizeof(locales[0]); l++) {
+                for (int compose = 1; compose >= 0; compose--) {
+                    snprintf(launch.name, sizeof(launch.name), "compose-%s", (compose ? "on" : "off"));
+                    launch.locale = locales[l];
+                    launch.compose = compose;
+                    run_launch(json, &first, &xvfb, argv[1], &launch);
+                }
+            }
+        }
+
+        xvfb_stop(&xvfb);
+    }
+
+    fprintf(json, "\n]}\n");
+    fclose(json);
+    remove_files();
+    printf("results written to %s\n", output);
+    return EXIT_SUCCESS;
+}
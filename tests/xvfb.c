@@ -0,0 +1,309 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * xvfb.c: runs i3lock on an Xvfb server for the tests, and watches what it
+ *         draws (DAMAGE) while typing on it (XTEST).
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+#include <xcb/xtest.h>
+
+#include "xvfb.h"
+
+#define MAX_MONITORS 4
+
+/*
+ * Returns whether an executable called name is in $PATH.
+ *
+ */
+static bool in_path(const char *name) {
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        return false;
+    }
+    char *dirs = strdup(path);
+    if (dirs == NULL) {
+        err(EXIT_FAILURE, "strdup");
+    }
+    bool found = false;
+    char *saveptr = NULL;
+    for (char *dir = strtok_r(dirs, ":", &saveptr); dir != NULL && !found; dir = strtok_r(NULL, ":", &saveptr)) {
+        char file[4096];
+        snprintf(file, sizeof(file), "%s/%s", dir, name);
+        found = (access(file, X_OK) == 0);
+    }
+    free(dirs);
+    return found;
+}
+
+void xvfb_start(struct xvfb *xvfb, int monitors, int width, int height) {
+    if (!in_path("Xvfb")) {
+        printf("Xvfb not found in $PATH, skipping\n");
+        exit(EXIT_SKIP);
+    }
+    if (monitors < 1 || monitors > MAX_MONITORS) {
+        errx(EXIT_FAILURE, "cannot start Xvfb with %d monitors", monitors);
+    }
+
+    /* Xvfb writes the display number it picked to displayfd once it accepts
+     * connections. */
+    int displayfd[2];
+    if (pipe(displayfd) != 0) {
+        err(EXIT_FAILURE, "pipe");
+    }
+    char fd[16];
+    snprintf(fd, sizeof(fd), "%d", displayfd[1]);
+    char geometry[32];
+    snprintf(geometry, sizeof(geometry), "%dx%dx24", width, height);
+    char screens[MAX_MONITORS][4];
+    const char *argv[8 + 3 * MAX_MONITORS] = {"Xvfb", "-displayfd", fd, "-nolisten", "tcp", "-noreset"};
+    int argc = 6;
+    for (int i = 0; i < monitors; i++) {
+        snprintf(screens[i], sizeof(screens[i]), "%d", i);
+        argv[argc++] = "-screen";
+        argv[argc++] = screens[i];
+        argv[argc++] = geometry;
+    }
+    if (monitors > 1) {
+        argv[argc++] = "+xinerama";
+    }
+    argv[argc] = NULL;
+
+    xvfb->pid = fork();
+    if (xvfb->pid == -1) {
+        err(EXIT_FAILURE, "fork");
+    }
+    if (xvfb->pid == 0) {
+        close(displayfd[0]);
+        const int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execvp("Xvfb", (char *const *)argv);
+        _exit(127);
+    }
+    close(displayfd[1]);
+
+    char number[16] = "";
+    size_t len = 0;
+    while (len < sizeof(number) - 1 && strchr(number, '\n') == NULL) {
+        const ssize_t n = read(displayfd[0], number + len, sizeof(number) - 1 - len);
+        if (n <= 0) {
+            errx(EXIT_FAILURE, "Xvfb did not start");
+        }
+        len += n;
+        number[len] = '\0';
+    }
+    close(displayfd[0]);
+    snprintf(xvfb->display, sizeof(xvfb->display), ":%d", atoi(number));
+    setenv("DISPLAY", xvfb->display, 1);
+
+    xvfb->conn = xcb_connect(xvfb->display, NULL);
+    if (xcb_connection_has_error(xvfb->conn)) {
+        errx(EXIT_FAILURE, "cannot connect to Xvfb on %s", xvfb->display);
+    }
+    xvfb->screen = xcb_setup_roots_iterator(xcb_get_setup(xvfb->conn)).data;
+
+    if (!xcb_get_extension_data(xvfb->conn, &xcb_test_id)->present) {
+        errx(EXIT_FAILURE, "Xvfb does not support XTEST");
+    }
+    const xcb_query_extension_reply_t *damage = xcb_get_extension_data(xvfb->conn, &xcb_damage_id);
+    if (!damage->present) {
+        errx(EXIT_FAILURE, "Xvfb does not support DAMAGE");
+    }
+    xvfb->damage_event_base = damage->first_event;
+    /* DAMAGE requests fail until the version was negotiated. */
+    free(xcb_damage_query_version_reply(xvfb->conn, xcb_damage_query_version(xvfb->conn, 1, 1), NULL));
+
+    xcb_change_window_attributes(xvfb->conn, xvfb->screen->root, XCB_CW_EVENT_MASK,
+                                 (uint32_t[]){XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY});
+    xcb_flush(xvfb->conn);
+}
+
+void xvfb_stop(struct xvfb *xvfb) {
+    xcb_disconnect(xvfb->conn);
+    kill(xvfb->pid, SIGTERM);
+    waitpid(xvfb->pid, NULL, 0);
+}
+
+pid_t spawn_i3lock(const char *i3lock, const char *const args[], int stderr_fd) {
+    int argc = 0;
+    while (args[argc] != NULL) {
+        argc++;
+    }
+    const char **argv = calloc(argc + 3, sizeof(char *));
+    if (argv == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+    argv[0] = i3lock;
+    argv[1] = "-n";
+    memcpy(argv + 2, args, argc * sizeof(char *));
+
+    const pid_t pid = fork();
+    if (pid == -1) {
+        err(EXIT_FAILURE, "fork");
+    }
+    if (pid == 0) {
+        if (stderr_fd != -1) {
+            dup2(stderr_fd, STDERR_FILENO);
+        }
+        execv(i3lock, (char *const *)argv);
+        _exit(127);
+    }
+    free(argv);
+    return pid;
+}
+
+int stop_i3lock(pid_t pid) {
+    int status;
+    for (int i = 0; i < 100; i++) {
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            return status;
+        }
+        if (i == 0) {
+            kill(pid, SIGTERM);
+        }
+        usleep(10 * 1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+xcb_generic_event_t *next_event(struct xvfb *xvfb, double timeout_ms) {
+    const double deadline = now_ms() + timeout_ms;
+    for (;;) {
+        xcb_generic_event_t *event = xcb_poll_for_event(xvfb->conn);
+        if (event != NULL) {
+            return event;
+        }
+        if (xcb_connection_has_error(xvfb->conn)) {
+            errx(EXIT_FAILURE, "lost the connection to Xvfb");
+        }
+        const double remaining = deadline - now_ms();
+        if (remaining <= 0) {
+            return NULL;
+        }
+        struct pollfd pfd = {.fd = xcb_get_file_descriptor(xvfb->conn), .events = POLLIN};
+        poll(&pfd, 1, (int)ceil(remaining));
+    }
+}
+
+xcb_window_t wait_for_map(struct xvfb *xvfb, double timeout_ms) {
+    const double deadline = now_ms() + timeout_ms;
+    xcb_generic_event_t *event;
+    while ((event = next_event(xvfb, deadline - now_ms())) != NULL) {
+        if ((event->response_type & 0x7F) == XCB_MAP_NOTIFY) {
+            const xcb_window_t window = ((xcb_map_notify_event_t *)event)->window;
+            free(event);
+            return window;
+        }
+        free(event);
+    }
+    return XCB_NONE;
+}
+
+bool wait_for_unmap(struct xvfb *xvfb, xcb_window_t window, double timeout_ms) {
+    const double deadline = now_ms() + timeout_ms;
+    xcb_generic_event_t *event;
+    while ((event = next_event(xvfb, deadline - now_ms())) != NULL) {
+        const int type = (event->response_type & 0x7F);
+        const bool unmapped = ((type == XCB_UNMAP_NOTIFY && ((xcb_unmap_notify_event_t *)event)->window == window) ||
+                               (type == XCB_DESTROY_NOTIFY && ((xcb_destroy_notify_event_t *)event)->window == window));
+        free(event);
+        if (unmapped) {
+            return true;
+        }
+    }
+    return false;
+}
+
+xcb_damage_damage_t watch_damage(struct xvfb *xvfb, xcb_window_t window) {
+    const xcb_damage_damage_t damage = xcb_generate_id(xvfb->conn);
+    xcb_damage_create(xvfb->conn, damage, window, XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+    xcb_flush(xvfb->conn);
+    return damage;
+}
+
+bool wait_for_damage(struct xvfb *xvfb, double timeout_ms) {
+    const double deadline = now_ms() + timeout_ms;
+    xcb_generic_event_t *event;
+    while ((event = next_event(xvfb, deadline - now_ms())) != NULL) {
+        const bool damaged = ((event->response_type & 0x7F) == xvfb->damage_event_base + XCB_DAMAGE_NOTIFY);
+        free(event);
+        if (damaged) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void drain_events(struct xvfb *xvfb, double timeout_ms) {
+    const double deadline = now_ms() + timeout_ms;
+    xcb_generic_event_t *event;
+    while ((event = next_event(xvfb, deadline - now_ms())) != NULL) {
+        free(event);
+    }
+}
+
+xcb_keycode_t keysym_to_keycode(struct xvfb *xvfb, xcb_keysym_t keysym) {
+    const xcb_setup_t *setup = xcb_get_setup(xvfb->conn);
+    const int count = setup->max_keycode - setup->min_keycode + 1;
+    xcb_get_keyboard_mapping_reply_t *reply = xcb_get_keyboard_mapping_reply(
+        xvfb->conn, xcb_get_keyboard_mapping(xvfb->conn, setup->min_keycode, count), NULL);
+    if (reply == NULL) {
+        errx(EXIT_FAILURE, "cannot get the keyboard mapping");
+    }
+    const xcb_keysym_t *keysyms = xcb_get_keyboard_mapping_keysyms(reply);
+    xcb_keycode_t keycode = 0;
+    for (int i = 0; i < count && keycode == 0; i++) {
+        if (keysyms[i * reply->keysyms_per_keycode] == keysym) {
+            keycode = setup->min_keycode + i;
+        }
+    }
+    free(reply);
+    if (keycode == 0) {
+        errx(EXIT_FAILURE, "no key produces keysym 0x%x", keysym);
+    }
+    return keycode;
+}
+
+void press_key(struct xvfb *xvfb, xcb_keycode_t keycode) {
+    xcb_test_fake_input(xvfb->conn, XCB_KEY_PRESS, keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    xcb_test_fake_input(xvfb->conn, XCB_KEY_RELEASE, keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    xcb_flush(xvfb->conn);
+}
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile(double *values, int n, double p) {
+    qsort(values, n, sizeof(double), compare_doubles);
+    return values[(int)ceil(n * p) - 1];
+}
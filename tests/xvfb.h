@@ -0,0 +1,117 @@
+#ifndef _XVFB_H
+#define _XVFB_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+
+/* Exit status which makes meson report a test as skipped. */
+#define EXIT_SKIP 77
+
+struct xvfb {
+    pid_t pid;
+    char display[16];
+    xcb_connection_t *conn;
+    xcb_screen_t *screen;
+    /* The first event number of the DAMAGE extension. */
+    uint8_t damage_event_base;
+};
+
+/*
+ * Starts Xvfb with the given number of monitors of width x height pixels
+ * (side by side, via Xinerama), sets $DISPLAY for i3lock and connects to
+ * it. The root window reports when windows are mapped or unmapped.
+ *
+ * Exits with EXIT_SKIP if Xvfb is not installed.
+ *
+ */
+void xvfb_start(struct xvfb *xvfb, int monitors, int width, int height);
+
+/*
+ * Disconnects from and terminates Xvfb.
+ *
+ */
+void xvfb_stop(struct xvfb *xvfb);
+
+/*
+ * Starts i3lock (without forking) with the given arguments (NULL-terminated,
+ * without argv[0]). Its stderr goes to stderr_fd, unless that is -1.
+ *
+ */
+pid_t spawn_i3lock(const char *i3lock, const char *const args[], int stderr_fd);
+
+/*
+ * Stops i3lock if it is still running and returns its exit status (as
+ * returned by waitpid()).
+ *
+ */
+int stop_i3lock(pid_t pid);
+
+/*
+ * Returns the next event, or NULL if none arrives within timeout_ms.
+ * The caller has to free() the event.
+ *
+ */
+xcb_generic_event_t *next_event(struct xvfb *xvfb, double timeout_ms);
+
+/*
+ * Waits for a window to be mapped (i3lock’s lock window) and returns it, or
+ * XCB_NONE if none is mapped within timeout_ms.
+ *
+ */
+xcb_window_t wait_for_map(struct xvfb *xvfb, double timeout_ms);
+
+/*
+ * Waits until window is unmapped (or destroyed). Returns false if that does
+ * not happen within timeout_ms.
+ *
+ */
+bool wait_for_unmap(struct xvfb *xvfb, xcb_window_t window, double timeout_ms);
+
+/*
+ * Starts reporting each area of window which is drawn to, see
+ * wait_for_damage().
+ *
+ */
+xcb_damage_damage_t watch_damage(struct xvfb *xvfb, xcb_window_t window);
+
+/*
+ * Waits until the window watched by watch_damage() is drawn to. Returns false
+ * if that does not happen within timeout_ms. Other events are discarded.
+ *
+ */
+bool wait_for_damage(struct xvfb *xvfb, double timeout_ms);
+
+/*
+ * Discards all events which arrive within timeout_ms.
+ *
+ */
+void drain_events(struct xvfb *xvfb, double timeout_ms);
+
+/*
+ * Returns the keycode of a key which produces keysym without modifiers.
+ *
+ */
+xcb_keycode_t keysym_to_keycode(struct xvfb *xvfb, xcb_keysym_t keysym);
+
+/*
+ * Presses and releases the key via XTEST.
+ *
+ */
+void press_key(struct xvfb *xvfb, xcb_keycode_t keycode);
+
+/*
+ * Returns the current time of CLOCK_MONOTONIC in milliseconds.
+ *
+ */
+double now_ms(void);
+
+/*
+ * Sorts values and returns the value below which the fraction p of them
+ * lies.
+ *
+ */
+double percentile(double *values, int n, double p);
+
+#endif
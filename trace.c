@@ -0,0 +1,89 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * trace.c: writes a timeline of what i3lock spends its time on (--trace-file)
+ *          in the JSON array variant of the Chrome trace event format.
+ *
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "trace.h"
+
+/* Buffered events are written at least this often (in seconds), so that the
+ * timeline of a running session can be looked at. */
+#define FLUSH_INTERVAL 1
+
+static FILE *trace_fp = NULL;
+static bool first_event = true;
+/* i3lock forks into the background after the window is mapped, but the whole
+ * session should show up as one process in the timeline. */
+static pid_t trace_pid;
+static time_t last_flush;
+
+static void trace_event(const char *name, char phase) {
+    if (trace_fp == NULL) {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fprintf(trace_fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%lld.%03ld,\"pid\":%d,\"tid\":%d}",
+            (first_event ? "" : ",\n"), name, phase,
+            (phase == 'i' ? "\"s\":\"t\"," : ""),
+            (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000, ts.tv_nsec % 1000,
+            (int)trace_pid, (int)trace_pid);
+    first_event = false;
+
+    if (ts.tv_sec - last_flush >= FLUSH_INTERVAL) {
+        fflush(trace_fp);
+        last_flush = ts.tv_sec;
+    }
+}
+
+void trace_open(const char *path) {
+    /* The file must not leak into the PAM modules or their helpers. */
+    if ((trace_fp = fopen(path, "we")) == NULL) {
+        err(EXIT_FAILURE, "Could not open trace file %s", path);
+    }
+    trace_pid = getpid();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    last_flush = ts.tv_sec;
+    fprintf(trace_fp, "[\n");
+}
+
+void trace_begin(const char *name) {
+    trace_event(name, 'B');
+}
+
+void trace_end(const char *name) {
+    trace_event(name, 'E');
+}
+
+void trace_instant(const char *name) {
+    trace_event(name, 'i');
+}
+
+void trace_flush(void) {
+    if (trace_fp != NULL) {
+        fflush(trace_fp);
+    }
+}
+
+void trace_close(void) {
+    if (trace_fp == NULL) {
+        return;
+    }
+    /* The closing bracket is optional in this format, so a trace of a
+     * session which ended in errx() can still be opened. */
+    fprintf(trace_fp, "\n]\n");
+    fclose(trace_fp);
+    trace_fp = NULL;
+}
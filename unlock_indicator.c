@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <sys/resource.h>
 #include <xcb/xcb.h>
 #include <xkbcommon/xkbcommon.h>
 #include <ev.h>
@@ -22,6 +23,12 @@
 #include "unlock_indicator.h"
 #include "randr.h"
 #include "dpi.h"
+#include "background.h"
+#include "display.h"
+#include "probes.h"
+#include "trace.h"
+#include "metrics.h"
+#include "watchdog.h"
 
 #define BUTTON_RADIUS 90
 #define BUTTON_SPACE (BUTTON_RADIUS + 5)
@@ -47,16 +54,16 @@ extern uint32_t last_resolution[2];
 /* Whether the unlock indicator is enabled (defaults to true). */
 extern bool unlock_indicator;
 
-/* List of pressed modifiers, or NULL if none are pressed. */
-extern char *modifier_string;
-/* Name of the current keyboard layout or NULL if not initialized. */
-char *layout_string = NULL;
 
 /* A Cairo surface containing the specified image (-i), if any. */
 extern cairo_surface_t *img;
 
 /* Whether the image should be tiled. */
 extern bool tile;
+/* Whether to free the image once it is on the X server (--low-memory). */
+extern bool low_memory;
+/* How the image is placed on each monitor. */
+extern scaling_mode_t scaling_mode;
 /* The background color to use (in hex). */
 extern char color[7];
 
@@ -84,21 +91,48 @@ extern xcb_screen_t *screen;
 /* Cache the screen’s visual, necessary for creating a Cairo context. */
 static xcb_visualtype_t *vistype;
 
+/* List of pressed modifiers, or empty if none are pressed. */
+static char modifier_string[64];
+/* Name of the current keyboard layout or empty if not initialized. */
+static char layout_string[128];
+
+/* The surfaces (and contexts) draw_image() renders to. They are kept across
+ * redraws, so that a key press does not allocate them again. */
+static cairo_surface_t *indicator_surface = NULL;
+static cairo_t *indicator_ctx = NULL;
+static cairo_surface_t *pixmap_surface = NULL;
+static cairo_t *pixmap_ctx = NULL;
+static xcb_pixmap_t surface_pixmap = XCB_NONE;
+static uint32_t surface_resolution[2];
+
+/* With --low-memory: the background (color and image, without the unlock
+ * indicator) on the X server, from which redraws copy. */
+static xcb_pixmap_t background_pixmap = XCB_NONE;
+static cairo_surface_t *background_surface = NULL;
+
+/* Patterns for painting img, the --low-memory background and the unlock
+ * indicator. Like the surfaces, they are kept across redraws instead of
+ * letting cairo_set_source_surface() allocate new ones every time. */
+static cairo_pattern_t *image_pattern = NULL;
+static cairo_pattern_t *background_pattern = NULL;
+static cairo_pattern_t *indicator_pattern = NULL;
+
+/* Bytes of image data drawn onto the X server, see count_upload(). */
+static uint64_t uploaded_bytes = 0;
+
 /* Maintain the current unlock/PAM state to draw the appropriate unlock
  * indicator. */
 unlock_state_t unlock_state;
 auth_state_t auth_state;
 
-static void string_append(char **string_ptr, const char *appended) {
-    char *tmp = NULL;
-    if (*string_ptr == NULL) {
-        if (asprintf(&tmp, "%s", appended) != -1) {
-            *string_ptr = tmp;
-        }
-    } else if (asprintf(&tmp, "%s, %s", *string_ptr, appended) != -1) {
-        free(*string_ptr);
-        *string_ptr = tmp;
-    }
+/*
+ * Appends to a comma-separated list in a fixed-size buffer, truncating it if
+ * it gets too long.
+ *
+ */
+static void string_append(char *string, size_t size, const char *appended) {
+    const size_t len = strlen(string);
+    snprintf(string + len, size - len, "%s%s", (len > 0 ? ", " : ""), appended);
 }
 
 static void display_button_text(
@@ -121,16 +155,13 @@ static void display_button_text(
 }
 
 static void update_layout_string() {
-    if (layout_string) {
-        free(layout_string);
-        layout_string = NULL;
-    }
+    layout_string[0] = '\0';
     xkb_layout_index_t num_layouts = xkb_keymap_num_layouts(xkb_keymap);
     for (xkb_layout_index_t i = 0; i < num_layouts; ++i) {
         if (xkb_state_layout_index_is_active(xkb_state, i, XKB_STATE_LAYOUT_EFFECTIVE)) {
             const char *name = xkb_keymap_layout_get_name(xkb_keymap, i);
             if (name) {
-                string_append(&layout_string, name);
+                string_append(layout_string, sizeof(layout_string), name);
             }
         }
     }
@@ -142,6 +173,7 @@ static void check_modifier_keys(void) {
     xkb_mod_index_t idx, num_mods;
     const char *mod_name;
 
+    modifier_string[0] = '\0';
     num_mods = xkb_keymap_num_mods(xkb_keymap);
 
     for (idx = 0; idx < num_mods; idx++) {
@@ -164,37 +196,132 @@ static void check_modifier_keys(void) {
              * leak state about the password. */
             continue;
         }
-        string_append(&modifier_string, mod_name);
+        string_append(modifier_string, sizeof(modifier_string), mod_name);
     }
 }
 
 /*
- * Draws global image with fill color onto a pixmap with the given
- * resolution and returns it.
+ * Releases the surfaces kept by draw_image(), e.g. before the pixmap they
+ * draw to is freed.
  *
  */
-void draw_image(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
-    const double scaling_factor = get_dpi_value() / 96.0;
-    int button_diameter_physical = ceil(scaling_factor * BUTTON_DIAMETER);
-    DEBUG("scaling_factor is %.f, physical diameter is %d px\n",
-          scaling_factor, button_diameter_physical);
+static void release_pixmap_surface(void) {
+    if (pixmap_surface == NULL) {
+        return;
+    }
+    cairo_destroy(pixmap_ctx);
+    cairo_surface_destroy(pixmap_surface);
+    pixmap_ctx = NULL;
+    pixmap_surface = NULL;
+    surface_pixmap = XCB_NONE;
+}
 
-    if (!vistype) {
-        vistype = get_root_visual_type(screen);
+/*
+ * Returns a context for drawing the unlock indicator of the given size, with
+ * a transparent background. The surface is only created again when the size
+ * (i.e. the DPI) changes.
+ *
+ */
+static cairo_t *get_indicator_ctx(int diameter) {
+    if (indicator_surface != NULL && cairo_image_surface_get_width(indicator_surface) != diameter) {
+        cairo_pattern_destroy(indicator_pattern);
+        cairo_destroy(indicator_ctx);
+        cairo_surface_destroy(indicator_surface);
+        indicator_surface = NULL;
+    }
+    if (indicator_surface == NULL) {
+        indicator_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, diameter, diameter);
+        indicator_ctx = cairo_create(indicator_surface);
+        indicator_pattern = cairo_pattern_create_for_surface(indicator_surface);
     }
 
-    /* Initialize cairo: Create one in-memory surface to render the unlock
-     * indicator on, create one XCB surface to actually draw (one or more,
-     * depending on the amount of screens) unlock indicators on. */
-    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, button_diameter_physical, button_diameter_physical);
-    cairo_t *ctx = cairo_create(output);
+    cairo_save(indicator_ctx);
+    cairo_set_operator(indicator_ctx, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(indicator_ctx);
+    cairo_restore(indicator_ctx);
+    /* The path is not part of the saved state, so drop what the previous
+     * redraw left behind. */
+    cairo_new_path(indicator_ctx);
+    return indicator_ctx;
+}
 
-    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
-    cairo_t *xcb_ctx = cairo_create(xcb_output);
+/*
+ * Returns a context for drawing onto bg_pixmap. The surface is only created
+ * again when the pixmap or the resolution changes.
+ *
+ */
+static cairo_t *get_pixmap_ctx(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
+    if (pixmap_surface != NULL &&
+        (surface_pixmap != bg_pixmap ||
+         surface_resolution[0] != resolution[0] || surface_resolution[1] != resolution[1])) {
+        release_pixmap_surface();
+    }
+    if (pixmap_surface == NULL) {
+        pixmap_surface = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
+        pixmap_ctx = cairo_create(pixmap_surface);
+        surface_pixmap = bg_pixmap;
+        surface_resolution[0] = resolution[0];
+        surface_resolution[1] = resolution[1];
+    }
+    cairo_new_path(pixmap_ctx);
+    return pixmap_ctx;
+}
 
-    /* After the first iteration, the pixmap will still contain the previous
-     * contents. Explicitly clear the entire pixmap with the background color
-     * first to get back into a defined state: */
+void count_upload(cairo_surface_t *image) {
+    uploaded_bytes += (uint64_t)cairo_image_surface_get_stride(image) * cairo_image_surface_get_height(image);
+}
+
+uint64_t get_uploaded_bytes(void) {
+    return uploaded_bytes;
+}
+
+static void release_image_pattern(void) {
+    if (image_pattern != NULL) {
+        cairo_pattern_destroy(image_pattern);
+        image_pattern = NULL;
+    }
+}
+
+/*
+ * Returns a pattern for painting img, which is only created again when img
+ * was replaced. As the pattern holds a reference to the image, a new image
+ * cannot be allocated at the same address as the one it was created for.
+ *
+ */
+static cairo_pattern_t *get_image_pattern(void) {
+    cairo_surface_t *surface;
+    if (image_pattern != NULL &&
+        (cairo_pattern_get_surface(image_pattern, &surface) != CAIRO_STATUS_SUCCESS || surface != img)) {
+        release_image_pattern();
+    }
+    if (image_pattern == NULL) {
+        /* cairo keeps the uploaded copy of img for as long as it exists. */
+        count_upload(img);
+        image_pattern = cairo_pattern_create_for_surface(img);
+        if (tile) {
+            cairo_pattern_set_extend(image_pattern, CAIRO_EXTEND_REPEAT);
+        }
+    }
+    return image_pattern;
+}
+
+/*
+ * Uses pattern as source of ctx, with its origin at x, y (like
+ * cairo_set_source_surface() does for a surface).
+ *
+ */
+static void set_source_at(cairo_t *ctx, cairo_pattern_t *pattern, int x, int y) {
+    cairo_matrix_t matrix;
+    cairo_matrix_init_translate(&matrix, -x, -y);
+    cairo_pattern_set_matrix(pattern, &matrix);
+    cairo_set_source(ctx, pattern);
+}
+
+/*
+ * Fills the background color and draws the image (if any) on top of it.
+ *
+ */
+static void draw_background(cairo_t *xcb_ctx, uint32_t *resolution) {
     char strgroups[3][3] = {{color[0], color[1], '\0'},
                             {color[2], color[3], '\0'},
                             {color[4], color[5], '\0'}};
@@ -206,20 +333,96 @@ void draw_image(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
     cairo_fill(xcb_ctx);
 
     if (img) {
-        if (!tile) {
-            cairo_set_source_surface(xcb_ctx, img, 0, 0);
+        if (scaling_mode != SCALING_NONE) {
+            draw_scaled_images(xcb_ctx);
+        } else if (!tile) {
+            cairo_set_source(xcb_ctx, get_image_pattern());
             cairo_paint(xcb_ctx);
         } else {
-            /* create a pattern and fill a rectangle as big as the screen */
-            cairo_pattern_t *pattern;
-            pattern = cairo_pattern_create_for_surface(img);
-            cairo_set_source(xcb_ctx, pattern);
-            cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+            /* repeat the image and fill a rectangle as big as the screen */
+            cairo_set_source(xcb_ctx, get_image_pattern());
             cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
             cairo_fill(xcb_ctx);
-            cairo_pattern_destroy(pattern);
         }
     }
+}
+
+void invalidate_background(void) {
+    release_image_pattern();
+    if (background_surface == NULL) {
+        return;
+    }
+    cairo_pattern_destroy(background_pattern);
+    background_pattern = NULL;
+    cairo_surface_destroy(background_surface);
+    xcb_free_pixmap(conn, background_pixmap);
+    background_surface = NULL;
+    background_pixmap = XCB_NONE;
+}
+
+/*
+ * Draws the background onto a pixmap on the X server and frees the image
+ * (and the images scaled for each monitor). Redraws then only copy from that
+ * pixmap, until the layout changes and the image is loaded again.
+ *
+ */
+static void upload_background(uint32_t *resolution) {
+    background_pixmap = create_bg_pixmap(conn, screen, resolution, color);
+    background_surface = cairo_xcb_surface_create(conn, background_pixmap, vistype, resolution[0], resolution[1]);
+    cairo_t *ctx = cairo_create(background_surface);
+    draw_background(ctx, resolution);
+    cairo_destroy(ctx);
+    cairo_surface_flush(background_surface);
+    background_pattern = cairo_pattern_create_for_surface(background_surface);
+
+    const long rss_before = current_rss_kib();
+    release_image_pattern();
+    cairo_surface_destroy(img);
+    img = NULL;
+    invalidate_scaled_images();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    DEBUG("freed the image after drawing it onto the X server, RSS %ld KiB -> %ld KiB (peak %ld KiB)\n",
+          rss_before, current_rss_kib(), usage.ru_maxrss);
+}
+
+/*
+ * Draws the background and the unlock indicator(s) for the current state
+ * onto xcb_ctx. Apart from the --low-memory background, this does not talk to
+ * the X server, so xcb_ctx can belong to any surface, e.g. an image surface.
+ *
+ */
+void draw_frame(cairo_t *xcb_ctx, uint32_t *resolution) {
+    const double scaling_factor = get_dpi_value() / 96.0;
+    int button_diameter_physical = ceil(scaling_factor * BUTTON_DIAMETER);
+    DEBUG("scaling_factor is %.f, physical diameter is %d px\n",
+          scaling_factor, button_diameter_physical);
+
+    /* Initialize cairo: Use one in-memory surface to render the unlock
+     * indicator on, which is then drawn (one or more times, depending on
+     * the amount of screens) onto xcb_ctx. It is reused across redraws, so
+     * the state of both contexts is saved and restored. */
+    cairo_t *ctx = get_indicator_ctx(button_diameter_physical);
+    cairo_save(ctx);
+    cairo_save(xcb_ctx);
+
+    trace_begin("draw_background");
+    /* After the first iteration, the pixmap will still contain the previous
+     * contents. Explicitly clear the entire pixmap with the background
+     * first to get back into a defined state: */
+    if (background_surface != NULL) {
+        cairo_set_source(xcb_ctx, background_pattern);
+        cairo_set_operator(xcb_ctx, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(xcb_ctx);
+        cairo_set_operator(xcb_ctx, CAIRO_OPERATOR_OVER);
+    } else {
+        draw_background(xcb_ctx, resolution);
+    }
+    PROBE(draw_background_end);
+    trace_end("draw_background");
+
+    trace_begin("draw_indicator");
 
     if (unlock_indicator &&
         (unlock_state >= STATE_KEY_PRESSED || auth_state > STATE_AUTH_IDLE)) {
@@ -332,11 +535,11 @@ void draw_image(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
             display_button_text(ctx, text, 0., use_dark_text);
         }
 
-        if (modifier_string != NULL) {
+        if (modifier_string[0] != '\0') {
             cairo_set_font_size(ctx, 14.0);
             display_button_text(ctx, modifier_string, 28., use_dark_text);
         }
-        if (show_keyboard_layout && layout_string != NULL) {
+        if (show_keyboard_layout && layout_string[0] != '\0') {
             cairo_set_font_size(ctx, 14.0);
             display_button_text(ctx, layout_string, -28., use_dark_text);
         }
@@ -383,12 +586,15 @@ void draw_image(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
         }
     }
 
+    /* The indicator was cleared and drawn again, so cairo uploads it once
+     * for all screens. */
+    count_upload(indicator_surface);
     if (xr_screens > 0) {
         /* Composite the unlock indicator in the middle of each screen. */
         for (int screen = 0; screen < xr_screens; screen++) {
             int x = (xr_resolutions[screen].x + ((xr_resolutions[screen].width / 2) - (button_diameter_physical / 2)));
             int y = (xr_resolutions[screen].y + ((xr_resolutions[screen].height / 2) - (button_diameter_physical / 2)));
-            cairo_set_source_surface(xcb_ctx, output, x, y);
+            set_source_at(xcb_ctx, indicator_pattern, x, y);
             cairo_rectangle(xcb_ctx, x, y, button_diameter_physical, button_diameter_physical);
             cairo_fill(xcb_ctx);
         }
@@ -396,17 +602,47 @@ void draw_image(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
         /* We have no information about the screen sizes/positions, so we just
          * place the unlock indicator in the middle of the X root window and
          * hope for the best. */
-        int x = (last_resolution[0] / 2) - (button_diameter_physical / 2);
-        int y = (last_resolution[1] / 2) - (button_diameter_physical / 2);
-        cairo_set_source_surface(xcb_ctx, output, x, y);
+        int x = (resolution[0] / 2) - (button_diameter_physical / 2);
+        int y = (resolution[1] / 2) - (button_diameter_physical / 2);
+        set_source_at(xcb_ctx, indicator_pattern, x, y);
         cairo_rectangle(xcb_ctx, x, y, button_diameter_physical, button_diameter_physical);
         cairo_fill(xcb_ctx);
     }
 
-    cairo_surface_destroy(xcb_output);
-    cairo_surface_destroy(output);
-    cairo_destroy(ctx);
-    cairo_destroy(xcb_ctx);
+    trace_end("draw_indicator");
+
+    cairo_restore(ctx);
+    cairo_restore(xcb_ctx);
+}
+
+/*
+ * Draws global image with fill color onto a pixmap with the given
+ * resolution and returns it.
+ *
+ */
+void draw_image(xcb_pixmap_t bg_pixmap, uint32_t *resolution) {
+    if (!vistype) {
+        vistype = get_root_visual_type(screen);
+    }
+
+    cairo_t *xcb_ctx = get_pixmap_ctx(bg_pixmap, resolution);
+    if (low_memory && img != NULL && background_surface == NULL) {
+        PROBE(upload_background_begin);
+        trace_begin("upload_background");
+        upload_background(resolution);
+        trace_end("upload_background");
+        PROBE(upload_background_end);
+    }
+    PROBE(draw_frame_begin);
+    draw_frame(xcb_ctx, resolution);
+    PROBE(draw_frame_end);
+
+    /* The pixmap is used by the X server right after this, so all drawing
+     * must have been sent to it. */
+    trace_begin("flush");
+    cairo_surface_flush(pixmap_surface);
+    trace_end("flush");
+    PROBE(flush_end);
 }
 
 static xcb_pixmap_t bg_pixmap = XCB_NONE;
@@ -417,6 +653,9 @@ static xcb_pixmap_t bg_pixmap = XCB_NONE;
  *
  */
 void free_bg_pixmap(void) {
+    if (surface_pixmap == bg_pixmap) {
+        release_pixmap_surface();
+    }
     xcb_free_pixmap(conn, bg_pixmap);
     bg_pixmap = XCB_NONE;
 }
@@ -426,12 +665,17 @@ void free_bg_pixmap(void) {
  *
  */
 void redraw_screen(void) {
+    if (display_skip_redraw()) {
+        metrics_count(METRIC_FRAMES_SKIPPED);
+        return;
+    }
+    PROBE2(redraw_begin, last_resolution[0], last_resolution[1]);
+    trace_begin("redraw_screen");
+    watchdog_enter("redraw_screen");
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     DEBUG("redraw_screen(unlock_state = %d, auth_state = %d)\n", unlock_state, auth_state);
 
-    if (modifier_string) {
-        free(modifier_string);
-        modifier_string = NULL;
-    }
     check_modifier_keys();
     update_layout_string();
 
@@ -441,11 +685,18 @@ void redraw_screen(void) {
     }
 
     draw_image(bg_pixmap, last_resolution);
+    trace_begin("clear");
     xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_pixmap});
     /* XXX: Possible optimization: Only update the area in the middle of the
      * screen instead of the whole screen. */
     xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
     xcb_flush(conn);
+    trace_end("clear");
+    metrics_observe_since(METRIC_REDRAW_SECONDS, &start);
+    metrics_count(METRIC_FRAMES_RENDERED);
+    watchdog_leave();
+    trace_end("redraw_screen");
+    PROBE2(redraw_end, last_resolution[0], last_resolution[1]);
 }
 
 /*
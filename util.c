@@ -0,0 +1,37 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * util.c: small helpers shared by several modules, declared in i3lock.h.
+ *
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "i3lock.h"
+
+/*
+ * Returns the resident set size of this process in KiB, or -1 if unknown.
+ *
+ */
+long current_rss_kib(void) {
+    long rss = -1;
+#if defined(__linux__)
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return -1;
+    }
+    long pages;
+    if (fscanf(statm, "%*d %ld", &pages) == 1) {
+        rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+    fclose(statm);
+#endif
+    return rss;
+}
+
+int skip_hidden_files(const struct dirent *ent) {
+    return ent->d_name[0] != '.';
+}
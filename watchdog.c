@@ -0,0 +1,194 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * watchdog.c: detects event loop iterations which took so long that i3lock
+ *             felt unresponsive, and which handler was to blame.
+ *
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <ev.h>
+#include <xcb/xcb.h>
+
+#include "i3lock.h"
+#include "watchdog.h"
+#include "metrics.h"
+#include "trace.h"
+
+extern bool debug_mode;
+
+/* Handlers nested deeper than this are attributed to their parent. */
+#define MAX_DEPTH 8
+
+/* Size of an X11 event on the wire (without GenericEvent payloads). */
+#define X11_EVENT_SIZE 32
+/* How many events are taken out of xcb's queue to count them. */
+#define MAX_HELD_EVENTS 1024
+
+static double threshold = 0;
+static xcb_connection_t *watched_conn;
+static ev_check iteration_begin;
+static ev_prepare iteration_end;
+
+/* When the current iteration started, 0 while blocking. */
+static double iteration_start = 0;
+
+/* Handlers currently running, with when they started and how much of that
+ * time was spent in nested handlers. */
+static struct {
+    const char *handler;
+    double start;
+    double nested;
+} stack[MAX_DEPTH];
+static int depth = 0;
+
+/* The handler which took the most time (excluding nested handlers) in the
+ * current iteration. */
+static const char *slowest_handler;
+static double slowest_duration;
+/* The most X11 events which were waiting when a handler which took longer
+ * than the threshold returned in the current iteration, -1 if none did. */
+static int backlog = -1;
+
+/* Events taken out of xcb's queue to count them, in order. They are handed
+ * out by watchdog_poll_for_event() before any other event. */
+static xcb_generic_event_t *held[MAX_HELD_EVENTS];
+static int held_start = 0;
+static int held_count = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void watchdog_enter(const char *handler) {
+    if (threshold == 0) {
+        return;
+    }
+    if (depth < MAX_DEPTH) {
+        stack[depth].handler = handler;
+        stack[depth].start = now();
+        stack[depth].nested = 0;
+    }
+    depth++;
+}
+
+/*
+ * Returns how many X11 events are waiting to be handled: those xcb already
+ * read from the socket and the ones still in the socket (an estimate). xcb
+ * cannot count its queue, so the events are moved from there to held.
+ *
+ */
+static int pending_events(void) {
+    xcb_generic_event_t *event;
+    while (held_count < MAX_HELD_EVENTS && (event = xcb_poll_for_queued_event(watched_conn)) != NULL) {
+        held[(held_start + held_count) % MAX_HELD_EVENTS] = event;
+        held_count++;
+    }
+    int bytes = 0;
+    if (ioctl(xcb_get_file_descriptor(watched_conn), FIONREAD, &bytes) == -1) {
+        bytes = 0;
+    }
+    return held_count + bytes / X11_EVENT_SIZE;
+}
+
+xcb_generic_event_t *watchdog_poll_for_event(xcb_connection_t *conn) {
+    if (held_count == 0) {
+        return xcb_poll_for_event(conn);
+    }
+    xcb_generic_event_t *event = held[held_start];
+    held_start = (held_start + 1) % MAX_HELD_EVENTS;
+    held_count--;
+    return event;
+}
+
+void watchdog_leave(void) {
+    if (threshold == 0 || depth == 0) {
+        return;
+    }
+    depth--;
+    if (depth >= MAX_DEPTH) {
+        return;
+    }
+    const double duration = now() - stack[depth].start;
+    const double self = duration - stack[depth].nested;
+    if (self > slowest_duration) {
+        slowest_handler = stack[depth].handler;
+        slowest_duration = self;
+    }
+    if (depth > 0) {
+        stack[depth - 1].nested += duration;
+    }
+    /* The events which queued up while the handler ran. Later in the
+     * iteration, they have been handled already. */
+    if (duration >= threshold) {
+        const int waiting = pending_events();
+        if (waiting > backlog) {
+            backlog = waiting;
+        }
+    }
+}
+
+/*
+ * Called first after the loop woke up (highest priority check watcher).
+ *
+ */
+static void iteration_begin_cb(EV_P_ ev_check *w, int revents) {
+    iteration_start = now();
+    slowest_handler = NULL;
+    slowest_duration = 0;
+    backlog = -1;
+}
+
+/*
+ * Called last before the loop blocks again (lowest priority prepare watcher).
+ *
+ */
+static void iteration_end_cb(EV_P_ ev_prepare *w, int revents) {
+    if (iteration_start == 0) {
+        return;
+    }
+    const double duration = now() - iteration_start;
+    iteration_start = 0;
+    if (duration < threshold) {
+        return;
+    }
+
+    metrics_count(METRIC_STALLS);
+    trace_instant("stall");
+    /* Without a slow handler, the stall consists of several shorter ones,
+     * and only the events waiting now are known. */
+    const int waiting = (backlog >= 0 ? backlog : pending_events());
+    if (slowest_handler != NULL) {
+        DEBUG("event loop stalled for %.0f ms, %.0f ms in %s, %d X11 events waiting\n",
+              duration * 1e3, slowest_duration * 1e3, slowest_handler, waiting);
+    } else {
+        DEBUG("event loop stalled for %.0f ms outside of the tracked handlers, %d X11 events waiting\n",
+              duration * 1e3, waiting);
+    }
+}
+
+void watchdog_start(struct ev_loop *loop, xcb_connection_t *conn, double stall_threshold) {
+    threshold = stall_threshold;
+    if (threshold == 0) {
+        return;
+    }
+    watched_conn = conn;
+
+    /* Within a priority, libev invokes the check watchers before the timers
+     * and I/O watchers, but in no particular order among themselves, and
+     * xcb_check_cb() is a check watcher as well. The highest priority makes
+     * this run before all of them. */
+    ev_check_init(&iteration_begin, iteration_begin_cb);
+    ev_set_priority(&iteration_begin, EV_MAXPRI);
+    ev_check_start(loop, &iteration_begin);
+
+    ev_prepare_init(&iteration_end, iteration_end_cb);
+    ev_set_priority(&iteration_end, EV_MINPRI);
+    ev_prepare_start(loop, &iteration_end);
+}
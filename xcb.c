@@ -11,6 +11,8 @@
 #include <xcb/xcb_image.h>
 #include <xcb/xcb_atom.h>
 #include <xcb/xcb_aux.h>
+#include <xcb/shm.h>
+#include <xcb/dpms.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -23,6 +25,8 @@
 
 #include "cursors.h"
 #include "unlock_indicator.h"
+#include "probes.h"
+#include "roundtrips.h"
 
 extern auth_state_t auth_state;
 
@@ -36,10 +40,10 @@ void _init_net_wm_bypass_compositor(xcb_connection_t *conn) {
         return;
     }
     xcb_generic_error_t *err;
-    xcb_intern_atom_reply_t *atom_reply = xcb_intern_atom_reply(
+    xcb_intern_atom_reply_t *atom_reply = ROUNDTRIP(xcb_intern_atom_reply(
         conn,
         xcb_intern_atom(conn, 0, strlen("_NET_WM_BYPASS_COMPOSITOR"), "_NET_WM_BYPASS_COMPOSITOR"),
-        &err);
+        &err));
     if (atom_reply == NULL) {
         fprintf(stderr, "X11 Error %d\n", err->error_code);
         free(err);
@@ -124,6 +128,196 @@ xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32
     return bg_pixmap;
 }
 
+/*
+ * Returns true if pixels in the server’s ZPixmap format for the root depth
+ * are 32-bit integers in our native byte order, i.e. the layout of cairo’s
+ * RGB24 format (and of --raw images in the 'native' pixel format).
+ *
+ */
+static bool server_uses_native_pixels(xcb_connection_t *conn, xcb_screen_t *scr) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (setup->image_byte_order != XCB_IMAGE_ORDER_LSB_FIRST) {
+        return false;
+    }
+#else
+    if (setup->image_byte_order != XCB_IMAGE_ORDER_MSB_FIRST) {
+        return false;
+    }
+#endif
+    for (xcb_format_iterator_t iter = xcb_setup_pixmap_formats_iterator(setup);
+         iter.rem;
+         xcb_format_next(&iter)) {
+        if (iter.data->depth == scr->root_depth) {
+            return (iter.data->bits_per_pixel == 32 && iter.data->scanline_pad <= 32);
+        }
+    }
+    return false;
+}
+
+/*
+ * Creates a pixmap with the contents of the shared memory file descriptor fd,
+ * which must contain width * height pixels in native format. The X server maps
+ * the memory read-only and either uses it as the pixmap’s storage directly
+ * (shared pixmaps) or copies it into the pixmap itself, so the pixels never
+ * pass through our process or the X11 socket.
+ *
+ * The file descriptor is consumed. Returns XCB_NONE if MIT-SHM ≥ 1.2 is not
+ * available or the server uses a different pixel format.
+ *
+ */
+xcb_pixmap_t create_pixmap_from_shm_fd(xcb_connection_t *conn, xcb_screen_t *scr, int fd, uint16_t width, uint16_t height) {
+    const xcb_query_extension_reply_t *extreply = xcb_get_extension_data(conn, &xcb_shm_id);
+    if (extreply == NULL || !extreply->present || !server_uses_native_pixels(conn, scr)) {
+        close(fd);
+        return XCB_NONE;
+    }
+
+    xcb_shm_query_version_reply_t *version =
+        ROUNDTRIP(xcb_shm_query_version_reply(conn, xcb_shm_query_version(conn), NULL));
+    if (version == NULL ||
+        version->major_version < 1 ||
+        (version->major_version == 1 && version->minor_version < 2)) {
+        /* Passing file descriptors requires MIT-SHM 1.2 */
+        free(version);
+        close(fd);
+        return XCB_NONE;
+    }
+    const bool shared_pixmaps = (version->shared_pixmaps &&
+                                 version->pixmap_format == XCB_IMAGE_FORMAT_Z_PIXMAP);
+    free(version);
+
+    xcb_generic_error_t *err;
+    xcb_shm_seg_t seg = xcb_generate_id(conn);
+    if ((err = ROUNDTRIP(xcb_request_check(conn, xcb_shm_attach_fd_checked(conn, seg, fd, true)))) != NULL) {
+        fprintf(stderr, "X11 Error %d\n", err->error_code);
+        free(err);
+        return XCB_NONE;
+    }
+
+    xcb_pixmap_t pixmap = xcb_generate_id(conn);
+    err = NULL;
+    if (!shared_pixmaps ||
+        (err = ROUNDTRIP(xcb_request_check(conn, xcb_shm_create_pixmap_checked(
+                                                     conn, pixmap, scr->root, width, height,
+                                                     scr->root_depth, seg, 0)))) != NULL) {
+        free(err);
+        xcb_create_pixmap(conn, scr->root_depth, pixmap, scr->root, width, height);
+        xcb_gcontext_t gc = xcb_generate_id(conn);
+        xcb_create_gc(conn, gc, pixmap, 0, NULL);
+        xcb_shm_put_image(conn, pixmap, gc,
+                          width, height, 0, 0, width, height, 0, 0,
+                          scr->root_depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                          false /* send_event */, seg, 0);
+        xcb_free_gc(conn, gc);
+    }
+
+    /* The server keeps the memory mapped for as long as a shared pixmap uses
+     * it, so we can detach the segment right away. */
+    xcb_shm_detach(conn, seg);
+    xcb_flush(conn);
+
+    return pixmap;
+}
+
+/*
+ * Copies the contents of the root window (width x height pixels, starting at
+ * the top left corner) into dest, in native format.
+ *
+ * If shm_fd is not -1, it must be a shared memory file descriptor backing
+ * dest, and the X server writes the pixels into it directly via MIT-SHM.
+ * Otherwise, or if that fails, the pixels are transferred over the X11 socket
+ * in strips. The file descriptor is not consumed.
+ *
+ * Returns false if the server uses a different pixel format or on error.
+ *
+ */
+bool get_root_image(xcb_connection_t *conn, xcb_screen_t *scr, int shm_fd, uint32_t *dest, uint16_t width, uint16_t height) {
+    if (width == 0 || height == 0) {
+        return false;
+    }
+    if (!server_uses_native_pixels(conn, scr)) {
+        fprintf(stderr, "Could not capture the screen: unsupported pixel format\n");
+        return false;
+    }
+
+    xcb_generic_error_t *err;
+    const xcb_query_extension_reply_t *extreply = xcb_get_extension_data(conn, &xcb_shm_id);
+    if (shm_fd != -1 && extreply != NULL && extreply->present) {
+        xcb_shm_query_version_reply_t *version =
+            ROUNDTRIP(xcb_shm_query_version_reply(conn, xcb_shm_query_version(conn), NULL));
+        /* Passing file descriptors requires MIT-SHM 1.2 */
+        const bool has_fd_passing = (version != NULL &&
+                                     (version->major_version > 1 ||
+                                      (version->major_version == 1 && version->minor_version >= 2)));
+        free(version);
+
+        int fd;
+        if (has_fd_passing && (fd = dup(shm_fd)) != -1) {
+            xcb_shm_seg_t seg = xcb_generate_id(conn);
+            /* xcb closes fd once it is sent. */
+            if ((err = ROUNDTRIP(xcb_request_check(conn, xcb_shm_attach_fd_checked(conn, seg, fd, false)))) == NULL) {
+                xcb_shm_get_image_reply_t *reply = ROUNDTRIP(xcb_shm_get_image_reply(
+                    conn,
+                    xcb_shm_get_image(conn, scr->root, 0, 0, width, height, ~0,
+                                      XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0),
+                    &err));
+                xcb_shm_detach(conn, seg);
+                const bool success = (reply != NULL && reply->size >= (uint32_t)width * height * 4);
+                free(reply);
+                if (success) {
+                    return true;
+                }
+            }
+            /* Fall back to GetImage below. */
+            free(err);
+        }
+    }
+
+    /* Limit each reply to about 4 MiB, so that xcb does not have to buffer a
+     * second copy of the entire screen. */
+    const int rows_per_request = (4 * 1024 * 1024) / (width * 4);
+    for (int y = 0; y < height; y += rows_per_request) {
+        const int rows = (height - y < rows_per_request ? height - y : rows_per_request);
+        xcb_get_image_reply_t *reply = ROUNDTRIP(xcb_get_image_reply(
+            conn,
+            xcb_get_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, scr->root, 0, y, width, rows, ~0),
+            &err));
+        if (reply == NULL) {
+            fprintf(stderr, "Could not capture the screen: X11 error %d\n", (err ? err->error_code : 0));
+            free(err);
+            return false;
+        }
+        if (xcb_get_image_data_length(reply) < width * rows * 4) {
+            fprintf(stderr, "Could not capture the screen: short reply\n");
+            free(reply);
+            return false;
+        }
+        memcpy(dest + (size_t)y * width, xcb_get_image_data(reply), (size_t)width * rows * 4);
+        free(reply);
+    }
+    return true;
+}
+
+/*
+ * Returns true if DPMS is enabled and has put the display into standby,
+ * suspend or off mode, i.e. nothing we draw is visible.
+ *
+ */
+bool display_is_off(xcb_connection_t *conn) {
+    const xcb_query_extension_reply_t *extreply = xcb_get_extension_data(conn, &xcb_dpms_id);
+    if (extreply == NULL || !extreply->present) {
+        return false;
+    }
+    xcb_dpms_info_reply_t *info = ROUNDTRIP(xcb_dpms_info_reply(conn, xcb_dpms_info(conn), NULL));
+    if (info == NULL) {
+        return false;
+    }
+    const bool off = (info->state && info->power_level != XCB_DPMS_DPMS_MODE_ON);
+    free(info);
+    return off;
+}
+
 xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, char *color, xcb_pixmap_t pixmap) {
     uint32_t mask = 0;
     uint32_t values[3];
@@ -198,7 +392,7 @@ xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, c
     xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_STACK_MODE, values);
 
     /* Ensure that the window is created and set up before returning */
-    xcb_aux_sync(conn);
+    ROUNDTRIP(xcb_aux_sync(conn));
 
     return win;
 }
@@ -238,8 +432,9 @@ bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
             cursor,              /* we change the cursor to whatever the user wanted */
             XCB_CURRENT_TIME);
 
-        if ((preply = xcb_grab_pointer_reply(conn, pcookie, NULL)) &&
-            preply->status == XCB_GRAB_STATUS_SUCCESS) {
+        preply = ROUNDTRIP(xcb_grab_pointer_reply(conn, pcookie, NULL));
+        PROBE2(grab_pointer, tries, preply ? preply->status : -1);
+        if (preply && preply->status == XCB_GRAB_STATUS_SUCCESS) {
             free(preply);
             break;
         }
@@ -275,8 +470,9 @@ bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
             XCB_GRAB_MODE_ASYNC, /* process events as normal, do not require sync */
             XCB_GRAB_MODE_ASYNC);
 
-        if ((kreply = xcb_grab_keyboard_reply(conn, kcookie, NULL)) &&
-            kreply->status == XCB_GRAB_STATUS_SUCCESS) {
+        kreply = ROUNDTRIP(xcb_grab_keyboard_reply(conn, kcookie, NULL));
+        PROBE2(grab_keyboard, tries, kreply ? kreply->status : -1);
+        if (kreply && kreply->status == XCB_GRAB_STATUS_SUCCESS) {
             free(kreply);
             break;
         }
@@ -377,10 +573,10 @@ void _init_net_active_window(xcb_connection_t *conn) {
         return;
     }
     xcb_generic_error_t *err;
-    xcb_intern_atom_reply_t *atom_reply = xcb_intern_atom_reply(
+    xcb_intern_atom_reply_t *atom_reply = ROUNDTRIP(xcb_intern_atom_reply(
         conn,
         xcb_intern_atom(conn, 0, strlen("_NET_ACTIVE_WINDOW"), "_NET_ACTIVE_WINDOW"),
-        &err);
+        &err));
     if (atom_reply == NULL) {
         fprintf(stderr, "X11 Error %d\n", err->error_code);
         free(err);
@@ -395,11 +591,11 @@ xcb_window_t find_focused_window(xcb_connection_t *conn, const xcb_window_t root
 
     _init_net_active_window(conn);
 
-    xcb_get_property_reply_t *prop_reply = xcb_get_property_reply(
+    xcb_get_property_reply_t *prop_reply = ROUNDTRIP(xcb_get_property_reply(
         conn,
         xcb_get_property_unchecked(
             conn, false, root, _NET_ACTIVE_WINDOW, XCB_GET_PROPERTY_TYPE_ANY, 0, 1 /* word */),
-        NULL);
+        NULL));
     if (prop_reply == NULL) {
         goto out;
     }